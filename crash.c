@@ -1,18 +1,49 @@
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
 #include <unistd.h>
 #include <string.h>
 #include <assert.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <poll.h>
+
+#include "crash_shm.h"
 
 #define MAXLINE 1024
+#define MAXJOBS 1024
+#define MAXDEPENDENCIES 32
+#define MAXCOPROCS 16
+
+// glob expansion reads directories with getdents64 into a buffer this big, and reuses a listing for this many seconds
+#define DIRENTBUFFER (1 << 20)
+#define LISTINGCACHESIZE 8
+#define LISTINGCACHETTL 2
+
+// the cache builtin keeps its store under this many bytes unless CRASH_CACHE_SIZE says otherwise
+#define CACHEDEFAULTSIZE (64 << 20)
+#define CACHEMAGIC 0x68636163u // "cach"
+#define CACHEVERSION 1
 
 // global variables
 int processCount = 0;
 pid_t foregroundPID = -1;
+int lastExitStatus = 0;
+volatile sig_atomic_t waitInterrupted = 0;
+bool subshell = false;
 
 // structs
 struct job {
@@ -21,28 +52,358 @@ struct job {
     bool running;
     bool stopped;
     char *commandName;
+    char *commandLine;
+    int exitStatus;
+    time_t startTime;
+
+    // jobs registered with after wait in the table until their dependencies finish
+    bool pending;
+    bool onlyOnSuccess;
+    bool dependencyFailed;
+    char **argv;
+    int assignmentCount; // NAME=value words at the front of argv, they go into the command's environment
+    int dependencies[MAXDEPENDENCIES];
+    int dependencyCount;
+};
+
+// how a command in a list is joined to the command after it
+enum connector {
+    CONNECT_END,
+    CONNECT_AND,
+    CONNECT_OR,
+};
+
+// the pieces a command line is split into before parsing
+enum lexKind {
+    LEX_WORD,
+    LEX_SEMICOLON,
+    LEX_BACKGROUND,
+    LEX_AND,
+    LEX_OR,
+};
+
+struct lexToken {
+    const char *text;
+    enum lexKind kind;
+};
+
+enum nodeType {
+    NODE_COMMAND,
+    NODE_REPEAT,
+    NODE_FOR,
+};
+
+// a parsed command line is an array of nodes: simple commands, and loops whose body is the span of nodes right after them
+// a line is parsed once, so a loop body runs again and again without being re-tokenized
+struct node {
+    enum nodeType type;
+    const char **toks;          // a command's tokens, or the words a for loop goes over
+    enum connector connector;   // how this node is joined to the next node of its list
+    bool background;            // set on the last node of a list that ended with &
+    const char *variable;       // for loops
+    long count;                 // repeat loops
+    int span;                   // how many of the following nodes make up the loop body
+};
+
+// the parser's position in the tokens of a line, and where it puts the nodes
+struct parser {
+    struct lexToken *tokens;
+    int tokenCount;
+    int position;
+    struct node *nodes;
+    int nodeCount;
+    int maxNodes;
+    const char **argv;
+    int argvCount;
+    int maxArgv;
+    bool error;
+};
+
+// an entry in the cache store is this header followed by the key, the stdout and the stderr of the command
+struct cacheEntryHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t exitStatus;
+    uint32_t keyLength;
+    uint64_t stdoutLength;
+    uint64_t stderrLength;
+};
+
+// a file in the cache store, for eviction and statistics
+struct cacheFile {
+    char name[24];
+    off_t size;
+    struct timespec modified;
+};
+
+// what the cache builtin did in this session
+struct cacheStatistics {
+    long hits;
+    long misses;
+    long stores;
+    long evictions;
+};
+
+// a shell variable, kept as a NAME=value entry so an exported variable can go into the environment as is
+// the entry buffer is reused when the variable is set again and the new value fits
+struct variable {
+    char *name;
+    size_t nameLength;
+    char *entry;
+    size_t entryCapacity;
+    bool exported;
+};
+
+// a block of text owned by a tokenStorage, blocks are kept and reused between commands
+struct textChunk {
+    struct textChunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+// storage for the tokens of a single command after expansion
+struct tokenStorage {
+    const char **toks;
+    int tokenCount;
+    int tokenCapacity;
+    struct textChunk *chunks;
+    struct textChunk *currentChunk;
+};
+
+// the entries of one directory as read by the glob scanner
+struct directoryListing {
+    char *path;
+    dev_t device;
+    ino_t inode;
+    struct timespec modified;
+    time_t readAt;
+    char *names;
+    size_t namesLength;
+    size_t *nameOffsets;
+    unsigned char *types;
+    int entryCount;
+    int entryCapacity;
+    size_t namesCapacity;
+};
+
+// a long-lived helper started with coproc, talked to over a pipe to its stdin and one from its stdout
+struct coprocess {
+    char *name;
+    int jobNumber;
+    pid_t pid;
+    int inputFd;
+    int outputFd;
+    char buffer[4096];
+    size_t buffered;
+};
+
+// pre-opened /proc files of one process sampled by jobs --watch
+struct processSample {
+    pid_t pid;
+    int statFd;
+    int statmFd;
+    int ioFd;
+    int childrenFd;
+    unsigned long long cpuTicks;
+    bool fresh;
+    bool seen;
+};
+
+// what jobs --watch shows for a job, summed over the processes in its process group
+struct jobUsage {
+    char state;
+    unsigned long long cpuTicks;
+    unsigned long long previousCpuTicks;
+    unsigned long long residentBytes;
+    unsigned long long readBytes;
+    unsigned long long writeBytes;
+    bool hasIO;
+};
+
+// growable buffer used to render builtin output so it can be emitted with a single write
+struct outputBuffer {
+    char *data;
+    size_t length;
+    size_t capacity;
 };
 
 
 // data structures
 
 // we'll use an array to store the jobs
-struct job jobs[32];
+struct job jobs[MAXJOBS];
+
+// reused between calls so polling the job list doesn't allocate
+static struct outputBuffer jobsOutput;
+
+// when the cache builtin runs a command, its stdout and stderr go to these files instead of the terminal
+static int captureFds[2] = {-1, -1};
+static struct cacheStatistics cacheStatistics = {0, 0, 0, 0};
+
+// shell variables, the environment crash was started with is imported as exported variables
+static struct variable *variables = NULL;
+static int variableCount = 0;
+static int variableCapacity = 0;
+
+// the envp passed to every program crash runs, rebuilt only when the set of exported variables changes
+// until then it's the environment crash was started with
+static char **environment = NULL;
+static bool environmentShared = true;
+
+// coprocesses by name, a slot is free when its name is NULL
+static struct coprocess coprocs[MAXCOPROCS];
+
+// the job table as published for external monitors, NULL if the segment couldn't be created
+static struct crashShmHeader *jobSegment = NULL;
+static char jobSegmentName[64];
+
+// processes sampled by jobs --watch, kept between refreshes so their /proc files are only opened once
+static struct processSample *samples = NULL;
+static int sampleCount = 0;
+static int sampleCapacity = 0;
 
 
+void eval(const char **toks, bool bg);
+void evalListInBackground(struct node *nodes, int nodeCount);
+void evalNodes(struct node *nodes, int nodeCount);
 static void signalMessage(int jobNumber, pid_t pid, char *commandName, int exitStatus, int value);
 static int intToStringLength(int number, char *buffer, int bufferLength);
-static int findJobIndexByJobNumber(int jobNumber);
+static char *joinTokens(const char **toks);
+static void bufferAppend(struct outputBuffer *buffer, const char *text, size_t length);
+static void bufferPrintf(struct outputBuffer *buffer, const char *format, ...);
+static void bufferAppendJSONString(struct outputBuffer *buffer, const char *text);
+static void bufferWrite(struct outputBuffer *buffer, int fd);
+static void waitWhileRunning(int jobIndex);
+static int findFreeJobSlot(void);
+static void releaseJobSlot(int jobIndex);
+static void signalJob(int jobIndex, int signalNumber);
+static int parseSignal(const char *name);
+static int findCoprocess(const char *name);
+static bool coprocessRunning(int coprocIndex);
+static void closeCoprocess(int coprocIndex);
+static bool waitForCoprocess(int fd, short events);
+static void openJobSegment(void);
+static void closeJobSegment(void);
+static void publishJob(int jobIndex);
+static void watchJobs(const char **args);
+static void cacheCommand(const char **args);
+static void cacheStats(void);
+static void cacheClear(void);
+static int parseJobArgument(const char *argument, const char *builtinName, bool includeFinished);
+static int addJob(int jobNumber, pid_t pid, const char *commandName, char *commandLine);
+static void resolveDependencies(int jobNumber, int exitStatus);
+static void startPendingJob(int jobIndex);
+static void cancelPendingJob(int jobIndex);
+static char *joinNodes(struct node *nodes, int nodeCount);
+static void storageFree(struct tokenStorage *storage);
+static const char *expandVariables(const char *token, struct tokenStorage *storage);
+static const char *getVariable(const char *name, size_t nameLength);
+static void setVariable(const char *name, size_t nameLength, const char *value, bool exported);
+static void unsetVariable(const char *name);
+static size_t variableNameLength(const char *s);
+static bool isAssignment(const char *token);
+static void importEnvironment();
+static void rebuildEnvironment();
+static char **environmentWithAssignments(const char **assignments, int assignmentCount);
+static void fillEnvironment(char **envp, const char **assignments, int assignmentCount);
+static void expandTokens(const char **toks, struct tokenStorage *storage, bool command);
+static void storageReset(struct tokenStorage *storage);
+static char *storageAlloc(struct tokenStorage *storage, size_t length);
+static void storagePush(struct tokenStorage *storage, const char *token);
+static int expandGlob(const char *pattern, struct tokenStorage *storage);
 
 
 void eval(const char **toks, bool bg) { // bg is true iff command ended with &
     assert(toks);
     if (*toks == NULL) return;
 
+    // builtins succeed unless they report an error
+    lastExitStatus = 0;
+
+    // NAME=value words in front of a command only go into that command's environment, on their own they set shell variables
+    const char **assignments = toks;
+    int assignmentCount = 0;
+
+    while (toks[assignmentCount] != NULL && isAssignment(toks[assignmentCount])) {
+        assignmentCount++;
+    }
+
+    if (toks[assignmentCount] == NULL) {
+        for (int i = 0; i < assignmentCount; i++) {
+            size_t nameLength = variableNameLength(assignments[i]);
+            setVariable(assignments[i], nameLength, assignments[i] + nameLength + 1, false);
+        }
+        return;
+    }
+
+    toks += assignmentCount;
+
+    // export [NAME[=value]...] marks variables for the environment of the programs crash runs
+    if (strcmp(toks[0], "export") == 0) {
+
+        // without arguments it lists the exported variables
+        if (toks[1] == NULL) {
+            for (int i = 0; environment[i] != NULL; i++) {
+                printf("export %s\n", environment[i]);
+            }
+            fflush(stdout);
+            return;
+        }
+
+        for (int i = 1; toks[i] != NULL; i++) {
+            size_t nameLength = variableNameLength(toks[i]);
+
+            if (nameLength == 0 || (toks[i][nameLength] != '\0' && toks[i][nameLength] != '=')) {
+                char errorMessage[MAXLINE];
+                int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: bad variable name for export: %s\n", toks[i]);
+                write(STDERR_FILENO, errorMessage, errorMessageLength);
+                lastExitStatus = 1;
+                continue;
+            }
+
+            // export NAME keeps the current value, or exports an empty one
+            const char *value = toks[i][nameLength] == '=' ? toks[i] + nameLength + 1 : getVariable(toks[i], nameLength);
+            setVariable(toks[i], nameLength, value != NULL ? value : "", true);
+        }
+        return;
+    }
+
+    // cache [--inputs FILE...] [--env NAME...] -- command... replays the output of a command that already ran with the same inputs
+    if (strcmp(toks[0], "cache") == 0) {
+        if (toks[1] != NULL && toks[2] == NULL && strcmp(toks[1], "--stats") == 0) {
+            cacheStats();
+        } else if (toks[1] != NULL && toks[2] == NULL && strcmp(toks[1], "--clear") == 0) {
+            cacheClear();
+        } else {
+            cacheCommand(toks + 1);
+        }
+        return;
+    }
+
+    // unset NAME... removes variables, and takes them out of the environment
+    if (strcmp(toks[0], "unset") == 0) {
+        for (int i = 1; toks[i] != NULL; i++) {
+            size_t nameLength = variableNameLength(toks[i]);
+
+            if (nameLength == 0 || toks[i][nameLength] != '\0') {
+                char errorMessage[MAXLINE];
+                int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: bad variable name for unset: %s\n", toks[i]);
+                write(STDERR_FILENO, errorMessage, errorMessageLength);
+                lastExitStatus = 1;
+                continue;
+            }
+
+            unsetVariable(toks[i]);
+        }
+        return;
+    }
+
     if (strcmp(toks[0], "quit") == 0) {
         if (toks[1] != NULL) {
             const char *msg = "ERROR: quit takes no arguments\n";
             write(STDERR_FILENO, msg, strlen(msg));
+            lastExitStatus = 1;
             return;
         } else {
             exit(0);
@@ -52,37 +413,123 @@ void eval(const char **toks, bool bg) { // bg is true iff command ended with &
     // check if the command is jobs
     if (strcmp(toks[0], "jobs") == 0) {
 
-        // check if there are any arguments
-        if (toks[1] == NULL) { 
+        // jobs --watch [interval [count]] is a live resource monitor
+        if (toks[1] != NULL && strcmp(toks[1], "--watch") == 0) {
+            watchJobs(toks + 2);
+            return;
+        }
 
-            // mask the signals
-            sigset_t mask;
-            sigemptyset(&mask);
-            sigaddset(&mask, SIGCHLD);
-            sigprocmask(SIG_BLOCK, &mask, NULL);
+        bool pidsOnly = false;
+        bool longForm = false;
+        bool json = false;
+        bool showRunning = false;
+        bool showSuspended = false;
+
+        // parse the options, short flags can be combined (e.g. -rl)
+        for (int i = 1; toks[i] != NULL; i++) {
+            if (strcmp(toks[i], "--json") == 0) {
+                json = true;
+                continue;
+            }
 
-            // print all the jobs
-            for (int i = 0; i < 32; i++) {
-                if (jobs[i].running) {
-                    printf("[%d] (%d)  running  %s\n", jobs[i].jobNumber, jobs[i].pid, jobs[i].commandName);
-                } else if (jobs[i].stopped) {
-                    printf("[%d] (%d)  suspended  %s\n", jobs[i].jobNumber, jobs[i].pid, jobs[i].commandName);
+            bool validOption = toks[i][0] == '-' && toks[i][1] != '\0';
+
+            for (int j = 1; validOption && toks[i][j] != '\0'; j++) {
+                switch (toks[i][j]) {
+                case 'p':
+                    pidsOnly = true;
+                    break;
+                case 'l':
+                    longForm = true;
+                    break;
+                case 'r':
+                    showRunning = true;
+                    break;
+                case 's':
+                    showSuspended = true;
+                    break;
+                default:
+                    validOption = false;
+                    break;
                 }
             }
 
-            fflush(stdout);
+            if (!validOption) {
+                char errorMessage[MAXLINE];
+                int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: bad argument for jobs: %s\n", toks[i]);
+                write(STDERR_FILENO, errorMessage, errorMessageLength);
+                lastExitStatus = 1;
+                fflush(stdout);
+                return;
+            }
+        }
 
-            // unmask the signals
-            sigprocmask(SIG_UNBLOCK, &mask, NULL);
+        // with no filter we show running, suspended and pending jobs
+        bool showPending = !showRunning && !showSuspended && !pidsOnly;
 
-            return;
-        } else {
-            const char *msg = "ERROR: jobs takes no arguments\n";
-            write(STDERR_FILENO, msg, strlen(msg));
+        if (!showRunning && !showSuspended) {
+            showRunning = true;
+            showSuspended = true;
+        }
 
-            fflush(stdout);
-            return;
+        // mask the signals
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &mask, NULL);
+
+        // render all the jobs into one buffer so they are emitted with a single write
+        jobsOutput.length = 0;
+        bool first = true;
+
+        if (json) {
+            bufferAppend(&jobsOutput, "[", 1);
+        }
+
+        for (int i = 0; i < MAXJOBS; i++) {
+            if (!(jobs[i].running && showRunning) && !(jobs[i].stopped && showSuspended) && !(jobs[i].pending && showPending)) {
+                continue;
+            }
+
+            const char *state = jobs[i].running ? "running" : jobs[i].stopped ? "suspended" : "pending";
+
+            // pending jobs have no PID yet
+            char pidString[16];
+            if (jobs[i].pending) {
+                snprintf(pidString, sizeof(pidString), json ? "null" : "-");
+            } else {
+                snprintf(pidString, sizeof(pidString), "%d", jobs[i].pid);
+            }
+
+            if (json) {
+                bufferPrintf(&jobsOutput, "%s{\"job\":%d,\"pid\":%s,\"state\":\"%s\",\"command\":",
+                             first ? "" : ",", jobs[i].jobNumber, pidString, state);
+                bufferAppendJSONString(&jobsOutput, jobs[i].commandName);
+                bufferPrintf(&jobsOutput, ",\"commandLine\":");
+                bufferAppendJSONString(&jobsOutput, jobs[i].commandLine);
+                bufferAppend(&jobsOutput, "}", 1);
+            } else if (pidsOnly) {
+                bufferPrintf(&jobsOutput, "%d\n", jobs[i].pid);
+            } else if (longForm) {
+                bufferPrintf(&jobsOutput, "[%d] (%s)  %s  %s\n", jobs[i].jobNumber, pidString, state, jobs[i].commandLine);
+            } else {
+                bufferPrintf(&jobsOutput, "[%d] (%s)  %s  %s\n", jobs[i].jobNumber, pidString, state, jobs[i].commandName);
+            }
+
+            first = false;
+        }
+
+        if (json) {
+            bufferAppend(&jobsOutput, "]\n", 2);
         }
+
+        fflush(stdout);
+        bufferWrite(&jobsOutput, STDOUT_FILENO);
+
+        // unmask the signals
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+        return;
     }
 
     // check if the command is nuke
@@ -97,9 +544,24 @@ void eval(const char **toks, bool bg) { // bg is true iff command ended with &
             sigprocmask(SIG_BLOCK, &mask, NULL);
 
             // kill all the jobs
-            for (int i = 0; i < 32; i++) {
+            for (int i = 0; i < MAXJOBS; i++) {
                 if (jobs[i].running || jobs[i].stopped) {
-                    kill(jobs[i].pid, SIGKILL);
+                    signalJob(i, SIGKILL);
+                }
+            }
+
+            // and drop the ones that haven't started yet, taking them all out of pending first so cancelling
+            // one can't start another that was waiting on it
+            static bool cancelling[MAXJOBS];
+            for (int i = 0; i < MAXJOBS; i++) {
+                cancelling[i] = jobs[i].pending;
+                jobs[i].pending = false;
+            }
+
+            for (int i = 0; i < MAXJOBS; i++) {
+                if (cancelling[i]) {
+                    jobs[i].pending = true;
+                    cancelPendingJob(i);
                 }
             }
 
@@ -112,100 +574,193 @@ void eval(const char **toks, bool bg) { // bg is true iff command ended with &
         // loop through the arguments
         for (int i = 1; toks[i] != NULL; i++) {
 
-            // check if the argument is a job number or pid
-            if (toks[i][0] == '%') {
+            // mask the signals
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigaddset(&mask, SIGCHLD);
+            sigprocmask(SIG_BLOCK, &mask, NULL);
+
+            int jobIndex = parseJobArgument(toks[i], "nuke", false);
 
-                // check if the job number is valid
-                int jobNumber = atoi(toks[i] + 1);
+            if (jobIndex == -1) {
+                lastExitStatus = 1;
+                fflush(stdout);
+                sigprocmask(SIG_UNBLOCK, &mask, NULL);
+                continue;
+            }
 
-                bool validInteger = true;
+            // a pending job is cancelled rather than killed
+            if (jobs[jobIndex].pending) {
+                cancelPendingJob(jobIndex);
+            } else {
+                signalJob(jobIndex, SIGKILL);
+            }
 
-                for (int j = 1; toks[i][j] != '\0'; j++) {
-                    if (toks[i][j] < '0' || toks[i][j] > '9') {
-                        validInteger = false;
-                        break;
-                    }
-                }
+            // unmask the signals
+            sigprocmask(SIG_UNBLOCK, &mask, NULL);
 
-                if (!validInteger || jobNumber < 1) {
-                    char errorMessage[MAXLINE];
-                    int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: bad argument for nuke: %s\n", toks[i]);
-                    write(STDERR_FILENO, errorMessage, errorMessageLength);
-                    fflush(stdout);
-                    continue;
-                }
+            // wait a bit
+            usleep(1000);
+        }
 
-                // mask the signals
-                sigset_t mask;
-                sigemptyset(&mask);
-                sigaddset(&mask, SIGCHLD);
-                sigprocmask(SIG_BLOCK, &mask, NULL);
+        return;
+    }
 
-                int jobIndex = findJobIndexByJobNumber(jobNumber);
+    // check if the command is kill
+    if (strcmp(toks[0], "kill") == 0) {
 
-                if (jobIndex == -1) {
-                    char errorMessage[MAXLINE];
-                    int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: no job %d\n", jobNumber);
-                    write(STDERR_FILENO, errorMessage, errorMessageLength);
-                    fflush(stdout);
-                    sigprocmask(SIG_UNBLOCK, &mask, NULL);
-                    continue;
-                }
+        int signalNumber = SIGTERM;
+        int firstArgument = 1;
 
-                // kill the job
-                kill(jobs[jobIndex].pid, SIGKILL);
+        // kill -SIG, kill -NUMBER or kill -s SIG
+        if (toks[1] != NULL && strcmp(toks[1], "-s") == 0) {
+            if (toks[2] == NULL) {
+                const char *msg = "ERROR: kill -s needs a signal name\n";
+                write(STDERR_FILENO, msg, strlen(msg));
+                lastExitStatus = 1;
+                return;
+            }
 
-                // unmask the signals
-                sigprocmask(SIG_UNBLOCK, &mask, NULL);
+            signalNumber = parseSignal(toks[2]);
+            firstArgument = 3;
+        } else if (toks[1] != NULL && toks[1][0] == '-') {
+            signalNumber = parseSignal(toks[1] + 1);
+            firstArgument = 2;
+        }
+
+        if (signalNumber == -1) {
+            char errorMessage[MAXLINE];
+            int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: bad signal for kill: %s\n", toks[firstArgument - 1]);
+            write(STDERR_FILENO, errorMessage, errorMessageLength);
+            lastExitStatus = 1;
+            return;
+        }
+
+        if (toks[firstArgument] == NULL) {
+            const char *msg = "ERROR: kill needs some arguments\n";
+            write(STDERR_FILENO, msg, strlen(msg));
+            lastExitStatus = 1;
+            return;
+        }
+
+        // check every target up front so the job table is only walked once
+        int targetCount = 0;
+        for (int i = firstArgument; toks[i] != NULL; i++) {
+            targetCount++;
+        }
 
-                // wait a bit
-                usleep(1000);
+        const char **targets = toks + firstArgument;
+        bool *targetMatched = calloc(targetCount, sizeof(bool));
+        int *targetNumbers = calloc(targetCount, sizeof(int));
 
+        if (targetMatched == NULL || targetNumbers == NULL) {
+            free(targetMatched);
+            free(targetNumbers);
+            lastExitStatus = 1;
+            return;
+        }
+
+        for (int t = 0; t < targetCount; t++) {
+            const char *target = targets[t];
+
+            // %name and %?substring match on the command line
+            if (target[0] == '%' && (target[1] < '0' || target[1] > '9')) {
+                if (target[1] == '\0' || (target[1] == '?' && target[2] == '\0')) {
+                    targetNumbers[t] = -1;
+                }
                 continue;
             }
 
-            // we assume the argument is a PID
-            pid_t pid = atoi(toks[i]);
-
-            // check if the pid is valid
-            bool validInteger = true;
+            // %N and PID are numbers
+            const char *digits = target[0] == '%' ? target + 1 : target;
+            bool validInteger = digits[0] != '\0';
 
-            for (int j = 0; toks[i][j] != '\0'; j++) {
-                if (toks[i][j] < '0' || toks[i][j] > '9') {
+            for (int j = 0; digits[j] != '\0'; j++) {
+                if (digits[j] < '0' || digits[j] > '9') {
                     validInteger = false;
                     break;
                 }
             }
 
-            if (!validInteger || pid < 0) {
-                char errorMessage[MAXLINE];
-                int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: bad argument for nuke: %s\n", toks[i]);
-                write(STDERR_FILENO, errorMessage, errorMessageLength);
-                fflush(stdout);
+            targetNumbers[t] = validInteger ? atoi(digits) : -1;
+        }
+
+        // mask the signals
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &mask, NULL);
+
+        for (int i = 0; i < MAXJOBS; i++) {
+            if (!jobs[i].running && !jobs[i].stopped) {
                 continue;
             }
 
-            // try to find a matching job
-            bool matchFound = false;
+            bool selected = false;
 
-            for (int j = 0; j < 32; j++) {
-                if ((jobs[j].running || jobs[j].stopped) && jobs[j].pid == pid) {
-                    matchFound = true;
-                    kill(jobs[j].pid, SIGKILL);
-                    fflush(stdout);
-                    break;
+            for (int t = 0; t < targetCount; t++) {
+                const char *target = targets[t];
+                bool matches = false;
+
+                if (targetNumbers[t] == -1) {
+                    continue;
+                } else if (target[0] != '%') {
+                    matches = jobs[i].pid == targetNumbers[t];
+                } else if (target[1] >= '0' && target[1] <= '9') {
+                    matches = jobs[i].jobNumber == targetNumbers[t];
+                } else if (target[1] == '?') {
+                    matches = strstr(jobs[i].commandLine, target + 2) != NULL;
+                } else {
+                    matches = strncmp(jobs[i].commandLine, target + 1, strlen(target + 1)) == 0;
+                }
+
+                if (matches) {
+                    targetMatched[t] = true;
+                    selected = true;
                 }
             }
 
-            if (!matchFound) {
-                char errorMessage[MAXLINE];
-                int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: no PID %d\n", pid);
-                write(STDERR_FILENO, errorMessage, errorMessageLength);
-                fflush(stdout);    
+            if (selected) {
+                signalJob(i, signalNumber);
+
+                // a suspended job has to be woken up to act on a terminating signal
+                if (jobs[i].stopped && (signalNumber == SIGTERM || signalNumber == SIGHUP || signalNumber == SIGINT)) {
+                    signalJob(i, SIGCONT);
+                }
+            }
+        }
+
+        // unmask the signals
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+        for (int t = 0; t < targetCount; t++) {
+            if (targetMatched[t]) {
+                continue;
             }
 
+            // a PID that isn't one of our jobs is signalled directly, like the kill command would
+            if (targets[t][0] != '%' && targetNumbers[t] > 0 && kill(targetNumbers[t], signalNumber) == 0) {
+                continue;
+            }
+
+            char errorMessage[MAXLINE];
+            int errorMessageLength;
+            if (targetNumbers[t] == -1) {
+                errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: bad argument for kill: %s\n", targets[t]);
+            } else if (targets[t][0] == '%' && (targets[t][1] < '0' || targets[t][1] > '9')) {
+                errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: no job matching %s\n", targets[t]);
+            } else if (targets[t][0] == '%') {
+                errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: no job %d\n", targetNumbers[t]);
+            } else {
+                errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: no PID %d\n", targetNumbers[t]);
+            }
+            write(STDERR_FILENO, errorMessage, errorMessageLength);
+            lastExitStatus = 1;
         }
 
+        free(targetMatched);
+        free(targetNumbers);
+
         return;
     }
 
@@ -217,143 +772,62 @@ void eval(const char **toks, bool bg) { // bg is true iff command ended with &
             char errorMessage[MAXLINE];
             int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: fg needs exactly one argument\n");
             write(STDERR_FILENO, errorMessage, errorMessageLength);
+            lastExitStatus = 1;
             fflush(stdout);
             return;
         } else if (toks[2] != NULL) {
             char errorMessage[MAXLINE];
             int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: fg needs exactly one argument\n");
             write(STDERR_FILENO, errorMessage, errorMessageLength);
+            lastExitStatus = 1;
             fflush(stdout);
             return;
         }
 
-        // check if the argument is a job number
-        if (toks[1][0] == '%') {
+        int jobIndex = parseJobArgument(toks[1], "fg", false);
 
-            // check if the job number is an integer
-            bool validInteger = true;
+        if (jobIndex == -1) {
+            lastExitStatus = 1;
+            fflush(stdout);
+            return;
+        }
 
-            for (int i = 1; toks[1][i] != '\0'; i++) {
-                if (toks[1][i] < '0' || toks[1][i] > '9') {
-                    validInteger = false;
-                    break;
-                }
-            }
+        // a job started by after has no process to bring forward until its dependencies finish
+        if (jobs[jobIndex].pending) {
+            char errorMessage[MAXLINE];
+            int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: job %d hasn't started yet\n", jobs[jobIndex].jobNumber);
+            write(STDERR_FILENO, errorMessage, errorMessageLength);
+            lastExitStatus = 1;
+            fflush(stdout);
+            return;
+        }
 
-            // check if the job number is valid
-            int jobNumber = atoi(toks[1] + 1);
+        // put the job in the foreground
 
-            if (!validInteger || jobNumber < 1) {
-                char errorMessage[MAXLINE];
-                int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: bad argument for fg: %s\n", toks[1]);
-                write(STDERR_FILENO, errorMessage, errorMessageLength);
-                fflush(stdout);
-                return;
-            }
-
-            int jobIndex = findJobIndexByJobNumber(jobNumber);
-
-            if (jobIndex == -1) {
-                char errorMessage[MAXLINE];
-                int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: no job %d\n", jobNumber);
-                write(STDERR_FILENO, errorMessage, errorMessageLength);
-                fflush(stdout);
-                return;
-            }
-
-            // put the job in the foreground
-
-            // check if the job was stopped
-            if (jobs[jobIndex].stopped) {
-
-                // send a continue signal
-                kill(jobs[jobIndex].pid, SIGCONT);
-
-                // mark the job as running again
-                jobs[jobIndex].stopped = false;
-                jobs[jobIndex].running = true;
-            }
-
-            // set the process group to the job's process group so it can receive signals
-            foregroundPID = jobs[jobIndex].pid;
-            tcsetpgrp(STDIN_FILENO, jobs[jobIndex].pid);
-
-            // wait for the job to finish
-            while (jobs[jobIndex].running) {
-                usleep(1000);
-            }
-
-            // set the process group back to the shells process group
-            tcsetpgrp(STDIN_FILENO, getpgid(0));
-            foregroundPID = -1;
-            return;
-        } else {
-            // we assume the argument is a PID
-            pid_t pid = atoi(toks[1]);
-
-            // check if the pid is valid
-            bool validInteger = true;
-
-            for (int j = 0; toks[1][j] != '\0'; j++) {
-                if (toks[1][j] < '0' || toks[1][j] > '9') {
-                    validInteger = false;
-                    break;
-                }
-            }
-
-            if (!validInteger || pid < 0) {
-                char errorMessage[MAXLINE];
-                int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: bad argument for fg: %s\n", toks[1]);
-                write(STDERR_FILENO, errorMessage, errorMessageLength);
-                fflush(stdout);
-                return;
-            }
-
-            // try to find a matching job
-            int jobIndex = -1;
-
-            for (int j = 0; j < 32; j++) {
-                if ((jobs[j].running || jobs[j].stopped) && jobs[j].pid == pid) {
-                    jobIndex = j;
-                    break;
-                }
-            }
-
-            // check if we found a match
-            if (jobIndex == -1) {
-                char errorMessage[MAXLINE];
-                int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: no PID %d\n", pid);
-                write(STDERR_FILENO, errorMessage, errorMessageLength);
-                fflush(stdout);
-                return;
-            }            
+        // check if the job was stopped
+        if (jobs[jobIndex].stopped) {
 
-            // check if the job was stopped
-            if (jobs[jobIndex].stopped) {
-                // send a continue signal
-                kill(jobs[jobIndex].pid, SIGCONT);
-
-                // mark the job as running again
-                jobs[jobIndex].stopped = false;
-                jobs[jobIndex].running = true;
-            }
+            // send a continue signal
+            signalJob(jobIndex, SIGCONT);
 
-            // put the job in the foreground
+            // mark the job as running again
+            jobs[jobIndex].stopped = false;
+            jobs[jobIndex].running = true;
+            publishJob(jobIndex);
+        }
 
-            // set the process group to the job's process group so it can receive signals
-            foregroundPID = jobs[jobIndex].pid;
-            tcsetpgrp(STDIN_FILENO, jobs[jobIndex].pid);
+        // set the process group to the job's process group so it can receive signals
+        foregroundPID = jobs[jobIndex].pid;
+        tcsetpgrp(STDIN_FILENO, jobs[jobIndex].pid);
 
-            // wait for the job to finish
-            while (jobs[jobIndex].running) {
-                usleep(1000);
-            }
+        // wait for the job to finish
+        waitWhileRunning(jobIndex);
+        lastExitStatus = jobs[jobIndex].exitStatus;
 
-            // set the process group back to the shells process group
-            tcsetpgrp(STDIN_FILENO, getpgid(0));
-            foregroundPID = -1;
-            return;
-        }
+        // set the process group back to the shells process group
+        tcsetpgrp(STDIN_FILENO, getpgid(0));
+        foregroundPID = -1;
+        return;
     }
 
     // check if the command is bg
@@ -362,6 +836,7 @@ void eval(const char **toks, bool bg) { // bg is true iff command ended with &
         if (toks[1] == NULL) {
             const char *msg = "ERROR: bg needs some arguments\n";
             write(STDERR_FILENO, msg, strlen(msg));
+            lastExitStatus = 1;
             fflush(stdout);
             return;
         }
@@ -374,527 +849,3708 @@ void eval(const char **toks, bool bg) { // bg is true iff command ended with &
 
         // process all the arguments
         for (int i = 1; toks[i] != NULL; i++) {
+            int jobIndex = parseJobArgument(toks[i], "bg", false);
+
+            if (jobIndex == -1) {
+                lastExitStatus = 1;
+                fflush(stdout);
+                continue;
+            }
 
-            // check if the argument is a job number
-            if (toks[i][0] == '%') {
+            // check if the job is stopped
+            if (!jobs[jobIndex].stopped) {
+                continue;
+            }
 
-                // check if the job number is an integer
-                bool validInteger = true;
+            // send a continue signal
+            signalJob(jobIndex, SIGCONT);
 
-                for (int j = 1; toks[i][j] != '\0'; j++) {
-                    if (toks[i][j] < '0' || toks[i][j] > '9') {
-                        validInteger = false;
-                        break;
-                    }
-                }
+            // mark the job as running again
+            jobs[jobIndex].stopped = false;
+            jobs[jobIndex].running = true;
+            publishJob(jobIndex);
+        }
 
-                // check if the job number is valid
-                int jobNumber = atoi(toks[i] + 1);
+        // unmask the signals
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
 
-                if (!validInteger || jobNumber < 1 ) {
-                    char errorMessage[MAXLINE];
-                    int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: bad argument for bg: %s\n", toks[i]);
-                    write(STDERR_FILENO, errorMessage, errorMessageLength);
-                    fflush(stdout);
-                    continue;
-                }
+        return;
+    }
 
-                int jobIndex = findJobIndexByJobNumber(jobNumber);
+    // check if the command is wait
+    if (strcmp(toks[0], "wait") == 0) {
 
-                if (jobIndex == -1) {
-                    char errorMessage[MAXLINE];
-                    int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: no job %d\n", jobNumber);
-                    write(STDERR_FILENO, errorMessage, errorMessageLength);
-                    fflush(stdout);
-                    continue;
-                }
+        bool waitForAny = false;
+        int firstArgument = 1;
 
-                // check if the job is stopped
-                if (!jobs[jobIndex].stopped) {
-                    continue;
-                }
+        if (toks[1] != NULL && strcmp(toks[1], "-n") == 0) {
+            waitForAny = true;
+            firstArgument = 2;
+        }
 
-                // send a continue signal
-                kill(jobs[jobIndex].pid, SIGCONT);
+        // resolve the jobs we are waiting on, remembering their job numbers in case a slot gets reused
+        int targetIndexes[MAXJOBS];
+        int targetJobNumbers[MAXJOBS];
+        int targetCount = 0;
 
-                // mark the job as running again
-                jobs[jobIndex].stopped = false;
-                jobs[jobIndex].running = true;
+        for (int i = firstArgument; toks[i] != NULL; i++) {
+            int jobIndex = parseJobArgument(toks[i], "wait", true);
 
-            } else {
-                // we assume the argument is a PID
-                pid_t pid = atoi(toks[i]);
+            if (jobIndex == -1) {
+                lastExitStatus = 127;
+                return;
+            }
 
-                // check if the pid is valid
-                bool validInteger = true;
+            if (targetCount < MAXJOBS) {
+                targetIndexes[targetCount] = jobIndex;
+                targetJobNumbers[targetCount] = jobs[jobIndex].jobNumber;
+                targetCount++;
+            }
+        }
 
-                for (int j = 0; toks[i][j] != '\0'; j++) {
-                    if (toks[i][j] < '0' || toks[i][j] > '9') {
-                        validInteger = false;
-                        break;
-                    }
-                }
+        // with no arguments we wait on every job that is currently running or pending
+        bool waitForAll = targetCount == 0;
 
-                if (!validInteger || pid < 0) {
-                    char errorMessage[MAXLINE];
-                    int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: bad argument for bg: %s\n", toks[i]);
-                    write(STDERR_FILENO, errorMessage, errorMessageLength);
-                    fflush(stdout);
-                    continue;
+        if (waitForAll) {
+            for (int i = 0; i < MAXJOBS; i++) {
+                if (jobs[i].running || jobs[i].pending) {
+                    targetIndexes[targetCount] = i;
+                    targetJobNumbers[targetCount] = jobs[i].jobNumber;
+                    targetCount++;
                 }
+            }
 
-                // try to find a matching job
-                int jobIndex = -1;
+            if (waitForAny && targetCount == 0) {
+                lastExitStatus = 127;
+                return;
+            }
+        }
 
-                for (int j = 0; j < 32; j++) {
-                    if ((jobs[j].running || jobs[j].stopped) && jobs[j].pid == pid) {
-                        jobIndex = j;
-                        break;
-                    }
-                }
+        // block SIGCHLD while checking the jobs and only sleep inside sigsuspend, so a child event
+        // can't slip in between the check and the wait
+        // SIGINT is blocked too, so a ctrl+c between the waitInterrupted check and sigsuspend isn't lost
+        sigset_t mask;
+        sigset_t previousMask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        sigaddset(&mask, SIGINT);
+        sigprocmask(SIG_BLOCK, &mask, &previousMask);
+
+        sigset_t suspendMask = previousMask;
+        sigdelset(&suspendMask, SIGCHLD);
+        sigdelset(&suspendMask, SIGINT);
+
+        waitInterrupted = 0;
+        int exitStatus = 0;
+        int remaining = targetCount;
+
+        while (remaining > 0) {
+            for (int i = 0; i < targetCount; i++) {
+                int jobIndex = targetIndexes[i];
 
-                // check if we found a match
                 if (jobIndex == -1) {
-                    char errorMessage[MAXLINE];
-                    int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: no PID %d\n", pid);
-                    write(STDERR_FILENO, errorMessage, errorMessageLength);
-                    fflush(stdout);
                     continue;
-                }            
+                }
 
-                // check if the job is stopped
-                if (!jobs[jobIndex].stopped) {
+                // the job is done once it stops running (or its slot was taken over by a new job)
+                if (jobs[jobIndex].jobNumber == targetJobNumbers[i] && (jobs[jobIndex].running || jobs[jobIndex].pending)) {
                     continue;
                 }
 
-                // send a continue signal
-                kill(jobs[jobIndex].pid, SIGCONT);
+                // wait -n reports the job that finished, otherwise the status is the one of the last job listed
+                if (jobs[jobIndex].jobNumber == targetJobNumbers[i] && (waitForAny || i == targetCount - 1)) {
+                    exitStatus = jobs[jobIndex].exitStatus;
+                }
+
+                targetIndexes[i] = -1;
+                remaining--;
+
+                if (waitForAny) {
+                    remaining = 0;
+                    break;
+                }
+            }
+
+            if (remaining == 0) {
+                break;
+            }
 
-                // mark the job as running again
-                jobs[jobIndex].stopped = false;
-                jobs[jobIndex].running = true;
+            if (waitInterrupted) {
+                // interrupted by ctrl+c, report it like a SIGINT termination
+                exitStatus = 128 + SIGINT;
+                break;
             }
+
+            sigsuspend(&suspendMask);
         }
 
-        // unmask the signals
-        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+        sigprocmask(SIG_SETMASK, &previousMask, NULL);
+
+        // waiting on everything always succeeds unless interrupted
+        if (waitForAll && !waitForAny && !waitInterrupted) {
+            exitStatus = 0;
+        }
 
+        lastExitStatus = exitStatus;
         return;
     }
 
+    // check if the command is after
+    if (strcmp(toks[0], "after") == 0) {
 
-    // check the process count
-    if (processCount >= 32) {
-        const char *msg = "ERROR: too many jobs\n";
-        write(STDERR_FILENO, msg, strlen(msg));
-        return;
-    }
+        bool onlyOnSuccess = false;
+        int firstArgument = 1;
 
-    processCount++;
+        if (toks[1] != NULL && (strcmp(toks[1], "-s") == 0 || strcmp(toks[1], "--success") == 0)) {
+            onlyOnSuccess = true;
+            firstArgument = 2;
+        }
 
-    // block any incoming signals using sigprocmask
-    sigset_t mask;
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGCHLD);
-    sigprocmask(SIG_BLOCK, &mask, NULL);
+        // find the -- that separates the jobs from the command
+        int separator = -1;
 
-    // fork the current process
-    pid_t pid = fork();        
+        for (int i = firstArgument; toks[i] != NULL; i++) {
+            if (strcmp(toks[i], "--") == 0) {
+                separator = i;
+                break;
+            }
+        }
 
-    if (pid == -1) {
-        const char *msg = "ERROR: fork didn't work\n";
-        write(STDERR_FILENO, msg, strlen(msg));
-        processCount--;
-        return;
-    }
+        // NAME=value words after the -- go into the command's environment, like in front of any other command
+        int assignmentCount = 0;
+        while (separator != -1 && toks[separator + 1 + assignmentCount] != NULL && isAssignment(toks[separator + 1 + assignmentCount])) {
+            assignmentCount++;
+        }
 
+        if (separator == -1 || separator == firstArgument || toks[separator + 1 + assignmentCount] == NULL) {
+            const char *msg = "ERROR: usage: after [-s] %N|PID ... -- command\n";
+            write(STDERR_FILENO, msg, strlen(msg));
+            lastExitStatus = 1;
+            return;
+        }
 
-    if (pid != 0 && bg) {
-        // parent process
-        printf("[%d] (%d)  running  %s\n", processCount, pid, toks[0]);
-        fflush(stdout);
+        // check the process count
+        if (findFreeJobSlot() == -1) {
+            const char *msg = "ERROR: too many jobs\n";
+            write(STDERR_FILENO, msg, strlen(msg));
+            lastExitStatus = 1;
+            return;
+        }
+
+        // mask the signals so no dependency can finish while we register the job
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &mask, NULL);
 
-        // prepare to add the job to the jobs array
         struct job newJob;
-        newJob.jobNumber = processCount;
-        newJob.pid = pid;
-        newJob.running = true;
-        newJob.stopped = false;
-        newJob.commandName = strdup(toks[0]);
-        
-        // add the job to the jobs array
-        for (int i = 0; i < 32; i++) {
-            if (!jobs[i].running && !jobs[i].stopped) {
-                jobs[i] = newJob;
-                break;
+        memset(&newJob, 0, sizeof(newJob));
+        newJob.pending = true;
+        newJob.onlyOnSuccess = onlyOnSuccess;
+
+        // dependencies that already finished are resolved right away
+        for (int i = firstArgument; i < separator; i++) {
+            int jobIndex = parseJobArgument(toks[i], "after", true);
+
+            if (jobIndex == -1) {
+                lastExitStatus = 1;
+                sigprocmask(SIG_UNBLOCK, &mask, NULL);
+                return;
             }
-        }
 
-        // unblock the signals
-        sigprocmask(SIG_UNBLOCK, &mask, NULL);
-        return;
-        
-    } else if (pid != 0 && !bg) {
-        // parent process
+            // a job named twice (e.g. %1 and its pid) is only waited on once, each reap removes a single entry
+            bool duplicate = false;
+            for (int j = 0; j < newJob.dependencyCount; j++) {
+                if (newJob.dependencies[j] == jobs[jobIndex].jobNumber) {
+                    duplicate = true;
+                }
+            }
+            if (duplicate) {
+                continue;
+            }
 
-        // add the job to the jobs array
-        struct job newJob;
-        newJob.jobNumber = processCount;
-        newJob.pid = pid;
-        newJob.running = true;
-        newJob.stopped = false;
-        newJob.commandName = strdup(toks[0]);
-        
-        int jobIndex = -1;
+            if (newJob.dependencyCount == MAXDEPENDENCIES) {
+                const char *msg = "ERROR: too many jobs for after\n";
+                write(STDERR_FILENO, msg, strlen(msg));
+                lastExitStatus = 1;
+                sigprocmask(SIG_UNBLOCK, &mask, NULL);
+                return;
+            }
 
-        for (int i = 0; i < 32; i++) {
-            if (!jobs[i].running && !jobs[i].stopped) {
-                jobs[i] = newJob;
-                jobIndex = i;
-                break;
+            if (jobs[jobIndex].running || jobs[jobIndex].stopped || jobs[jobIndex].pending) {
+                newJob.dependencies[newJob.dependencyCount++] = jobs[jobIndex].jobNumber;
+            } else if (jobs[jobIndex].exitStatus != 0) {
+                newJob.dependencyFailed = true;
             }
         }
 
-        // unblock the signals
-        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+        // copy the command now so it can be started straight from the SIGCHLD handler
+        int argc = 0;
+        while (toks[separator + 1 + argc] != NULL) {
+            argc++;
+        }
 
-        // create a new process group for the child process to differentiate between foreground processes for signals
-        setpgid(pid, pid);
-        foregroundPID = pid;
-        // transfer control to the child process group
-        tcsetpgrp(STDIN_FILENO, pid);
+        newJob.argv = malloc((argc + 1) * sizeof(char *));
+        for (int i = 0; i < argc; i++) {
+            newJob.argv[i] = strdup(toks[separator + 1 + i]);
+        }
+        newJob.argv[argc] = NULL;
+        newJob.assignmentCount = assignmentCount;
 
-        // wait for the child process to finish
-        while (jobIndex != -1 && jobs[jobIndex].running) {
-            usleep(1000);
+        processCount++;
+        newJob.jobNumber = processCount;
+        newJob.commandName = strdup(newJob.argv[assignmentCount]);
+        newJob.commandLine = joinTokens(toks + separator + 1);
+        newJob.startTime = time(NULL);
+
+        int jobIndex = findFreeJobSlot();
+
+        if (jobIndex != -1) {
+            releaseJobSlot(jobIndex);
+            jobs[jobIndex] = newJob;
+            publishJob(jobIndex);
+
+            printf("[%d] (-)  pending  %s\n", newJob.jobNumber, newJob.commandName);
+            fflush(stdout);
+
+            if (newJob.dependencyCount == 0) {
+                startPendingJob(jobIndex);
+            }
         }
 
-        // set the process group back to the shells process group
-        tcsetpgrp(STDIN_FILENO, getpgid(0));
-        foregroundPID = -1;
+        // unmask the signals
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
 
         return;
     }
-    
-    // child process
-    setpgid(0, 0);
 
-    // unblock the signals
-    sigprocmask(SIG_UNBLOCK, &mask, NULL);
-    
-    // reset the signal handlers
-    signal(SIGINT, SIG_DFL);
-    signal(SIGQUIT, SIG_DFL);
-    signal(SIGTSTP, SIG_DFL);
+    // check if the command is coproc
+    if (strcmp(toks[0], "coproc") == 0) {
 
-    // execute the command
-    int checkValue = execvp(toks[0], toks);
+        if (toks[1] == NULL || toks[2] == NULL) {
+            const char *msg = "ERROR: usage: coproc NAME command\n";
+            write(STDERR_FILENO, msg, strlen(msg));
+            lastExitStatus = 1;
+            return;
+        }
 
-    if (checkValue == -1) {
-        // print the error message
-        char errorMessage[MAXLINE];
-        int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: cannot run %s\n", toks[0]);
-        write(STDERR_FILENO, errorMessage, errorMessageLength);
-        exit(1);
-    }
+        // mask the signals
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &mask, NULL);
 
-}
+        // a name can be reused once its coprocess is gone
+        int coprocIndex = findCoprocess(toks[1]);
 
+        if (coprocIndex != -1 && coprocessRunning(coprocIndex)) {
+            char errorMessage[MAXLINE];
+            int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: coproc %s is already running\n", toks[1]);
+            write(STDERR_FILENO, errorMessage, errorMessageLength);
+            lastExitStatus = 1;
+            sigprocmask(SIG_UNBLOCK, &mask, NULL);
+            return;
+        }
 
-void parse_and_eval(char *s) {
-    assert(s);
-    const char *toks[MAXLINE+1];
-    
-    while (*s != '\0') {
-        bool end = false;
-        bool bg = false;
-        int t = 0;
-
-        while (*s != '\0' && !end) {
-            while (*s == '\n' || *s == '\t' || *s == ' ') ++s;
-            if (*s != ';' && *s != '&' && *s != '\0') toks[t++] = s;
-            while (strchr("&;\n\t ", *s) == NULL) ++s;
-            switch (*s) {
-            case '&':
-                bg = true;
-                end = true;
-                break;
-            case ';':
-                end = true;
-                break;
+        if (coprocIndex != -1) {
+            closeCoprocess(coprocIndex);
+        }
+
+        // otherwise take a free slot, or the slot of a coprocess that exited
+        for (int i = 0; coprocIndex == -1 && i < MAXCOPROCS; i++) {
+            if (coprocs[i].name == NULL) {
+                coprocIndex = i;
+            } else if (!coprocessRunning(i)) {
+                closeCoprocess(i);
+                coprocIndex = i;
             }
-            if (*s) *s++ = '\0';
         }
-        toks[t] = NULL;
-        eval(toks, bg);
-    }
-}
+
+        if (coprocIndex == -1 || findFreeJobSlot() == -1) {
+            const char *msg = "ERROR: too many jobs\n";
+            write(STDERR_FILENO, msg, strlen(msg));
+            lastExitStatus = 1;
+            sigprocmask(SIG_UNBLOCK, &mask, NULL);
+            return;
+        }
+
+        // the shell's ends are close-on-exec so other jobs don't hold them open
+        int toCoprocess[2];
+        int fromCoprocess[2];
+
+        if (pipe2(toCoprocess, O_CLOEXEC) == -1) {
+            perror("ERROR");
+            lastExitStatus = 1;
+            sigprocmask(SIG_UNBLOCK, &mask, NULL);
+            return;
+        }
+
+        if (pipe2(fromCoprocess, O_CLOEXEC) == -1) {
+            perror("ERROR");
+            close(toCoprocess[0]);
+            close(toCoprocess[1]);
+            lastExitStatus = 1;
+            sigprocmask(SIG_UNBLOCK, &mask, NULL);
+            return;
+        }
+
+        pid_t pid = fork();
+
+        if (pid == -1) {
+            const char *msg = "ERROR: fork didn't work\n";
+            write(STDERR_FILENO, msg, strlen(msg));
+            close(toCoprocess[0]);
+            close(toCoprocess[1]);
+            close(fromCoprocess[0]);
+            close(fromCoprocess[1]);
+            lastExitStatus = 1;
+            sigprocmask(SIG_UNBLOCK, &mask, NULL);
+            return;
+        }
+
+        if (pid == 0) {
+            // child process: stdin and stdout are the pipes
+            setpgid(0, 0);
+
+            dup2(toCoprocess[0], STDIN_FILENO);
+            dup2(fromCoprocess[1], STDOUT_FILENO);
+
+            sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+            signal(SIGINT, SIG_DFL);
+            signal(SIGQUIT, SIG_DFL);
+            signal(SIGTSTP, SIG_DFL);
+            signal(SIGPIPE, SIG_DFL);
+
+            execvpe(toks[2], (char *const *) toks + 2, environment);
+
+            char errorMessage[MAXLINE];
+            int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: cannot run %s\n", toks[2]);
+            write(STDERR_FILENO, errorMessage, errorMessageLength);
+            exit(127);
+        }
+
+        // parent process
+        setpgid(pid, pid);
+        close(toCoprocess[0]);
+        close(fromCoprocess[1]);
+
+        processCount++;
+
+        printf("[%d] (%d)  running  %s\n", processCount, pid, toks[2]);
+        fflush(stdout);
+
+        addJob(processCount, pid, toks[2], joinTokens(toks + 2));
+
+        coprocs[coprocIndex].name = strdup(toks[1]);
+        coprocs[coprocIndex].jobNumber = processCount;
+        coprocs[coprocIndex].pid = pid;
+        coprocs[coprocIndex].inputFd = toCoprocess[1];
+        coprocs[coprocIndex].outputFd = fromCoprocess[0];
+
+        // coproc-send never blocks in write, it waits for room with ppoll so ctrl+c can stop it
+        fcntl(toCoprocess[1], F_SETFL, fcntl(toCoprocess[1], F_GETFL) | O_NONBLOCK);
+        coprocs[coprocIndex].buffered = 0;
+
+        // unmask the signals
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+        return;
+    }
+
+    // check if the command is coproc-send, coproc-read or coproc-close
+    if (strcmp(toks[0], "coproc-send") == 0 || strcmp(toks[0], "coproc-read") == 0 || strcmp(toks[0], "coproc-close") == 0) {
+
+        bool send = strcmp(toks[0], "coproc-send") == 0;
+
+        if (toks[1] == NULL || (!send && toks[2] != NULL)) {
+            char errorMessage[MAXLINE];
+            int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: usage: %s NAME%s\n", toks[0], send ? " words..." : "");
+            write(STDERR_FILENO, errorMessage, errorMessageLength);
+            lastExitStatus = 1;
+            return;
+        }
+
+        int coprocIndex = findCoprocess(toks[1]);
+
+        if (coprocIndex == -1) {
+            char errorMessage[MAXLINE];
+            int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: no coproc %s\n", toks[1]);
+            write(STDERR_FILENO, errorMessage, errorMessageLength);
+            lastExitStatus = 1;
+            return;
+        }
+
+        struct coprocess *coproc = &coprocs[coprocIndex];
+
+        if (strcmp(toks[0], "coproc-close") == 0) {
+            // closing its stdin lets the coprocess see end of file and exit
+            if (coproc->inputFd != -1) {
+                close(coproc->inputFd);
+                coproc->inputFd = -1;
+            }
+            return;
+        }
+
+        if (send) {
+            // send the words as one line with a single write
+            char *line = joinTokens(toks + 2);
+            size_t lineLength = strlen(line);
+            line[lineLength] = '\n';
+
+            size_t written = 0;
+            bool interrupted = false;
+            waitInterrupted = 0;
+
+            while (coproc->inputFd != -1 && written < lineLength + 1) {
+                ssize_t result = write(coproc->inputFd, line + written, lineLength + 1 - written);
+
+                // the pipe is full until the coprocess reads some of it
+                if (result == -1 && errno == EAGAIN) {
+                    if (!waitForCoprocess(coproc->inputFd, POLLOUT)) {
+                        interrupted = true;
+                        break;
+                    }
+                    continue;
+                }
+                if (result == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (result <= 0) {
+                    break;
+                }
+                written += result;
+            }
+
+            free(line);
+
+            if (interrupted) {
+                lastExitStatus = 128 + SIGINT;
+                return;
+            }
+
+            if (written < lineLength + 1) {
+                char errorMessage[MAXLINE];
+                int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: coproc %s isn't reading\n", toks[1]);
+                write(STDERR_FILENO, errorMessage, errorMessageLength);
+                lastExitStatus = 1;
+            }
+            return;
+        }
+
+        // read one line, keeping anything after it buffered for the next coproc-read
+        waitInterrupted = 0;
+
+        while (true) {
+            char *newline = memchr(coproc->buffer, '\n', coproc->buffered);
+
+            // a line longer than the buffer is handed over in pieces
+            if (newline != NULL || coproc->buffered == sizeof(coproc->buffer)) {
+                size_t lineLength = newline != NULL ? (size_t) (newline - coproc->buffer) + 1 : coproc->buffered;
+
+                fflush(stdout);
+                write(STDOUT_FILENO, coproc->buffer, lineLength);
+
+                coproc->buffered -= lineLength;
+                memmove(coproc->buffer, coproc->buffer + lineLength, coproc->buffered);
+                return;
+            }
+
+            // ctrl+c can interrupt a read from a stuck coprocess
+            if (!waitForCoprocess(coproc->outputFd, POLLIN)) {
+                lastExitStatus = 128 + SIGINT;
+                return;
+            }
+
+            ssize_t result = read(coproc->outputFd, coproc->buffer + coproc->buffered, sizeof(coproc->buffer) - coproc->buffered);
+
+            if (result == -1 && errno == EINTR) {
+                continue;
+            }
+
+            if (result <= 0) {
+                // end of file, hand over whatever is left without a newline
+                if (coproc->buffered > 0) {
+                    fflush(stdout);
+                    write(STDOUT_FILENO, coproc->buffer, coproc->buffered);
+                    write(STDOUT_FILENO, "\n", 1);
+                    coproc->buffered = 0;
+                    return;
+                }
+
+                char errorMessage[MAXLINE];
+                int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: coproc %s has no more output\n", toks[1]);
+                write(STDERR_FILENO, errorMessage, errorMessageLength);
+                lastExitStatus = 1;
+                return;
+            }
+
+            coproc->buffered += result;
+        }
+    }
+
+    // check the process count
+    if (findFreeJobSlot() == -1) {
+        const char *msg = "ERROR: too many jobs\n";
+        write(STDERR_FILENO, msg, strlen(msg));
+        lastExitStatus = 1;
+        return;
+    }
+
+    processCount++;
+
+    // block any incoming signals using sigprocmask
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    // fork the current process
+    pid_t pid = fork();        
+
+    if (pid == -1) {
+        const char *msg = "ERROR: fork didn't work\n";
+        write(STDERR_FILENO, msg, strlen(msg));
+        lastExitStatus = 1;
+        processCount--;
+        return;
+    }
+
+
+    if (pid != 0 && bg) {
+        // parent process
+
+        // put the child in its own process group right away so the whole job can be signalled
+        if (!subshell) {
+            setpgid(pid, pid);
+        }
+
+        printf("[%d] (%d)  running  %s\n", processCount, pid, toks[0]);
+        fflush(stdout);
+
+        // add the job to the jobs array
+        addJob(processCount, pid, toks[0], joinTokens(assignments));
+
+        // unblock the signals
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+        return;
+        
+    } else if (pid != 0 && !bg) {
+        // parent process
+
+        // add the job to the jobs array
+        int jobIndex = addJob(processCount, pid, toks[0], joinTokens(assignments));
+
+        // unblock the signals
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+        // inside a subshell the children stay in the subshell's process group and the terminal isn't ours
+        if (!subshell) {
+            // create a new process group for the child process to differentiate between foreground processes for signals
+            setpgid(pid, pid);
+            foregroundPID = pid;
+            // transfer control to the child process group
+            tcsetpgrp(STDIN_FILENO, pid);
+        }
+
+        // wait for the child process to finish
+        if (jobIndex != -1) {
+            waitWhileRunning(jobIndex);
+            lastExitStatus = jobs[jobIndex].exitStatus;
+        }
+
+        if (!subshell) {
+            // set the process group back to the shells process group
+            tcsetpgrp(STDIN_FILENO, getpgid(0));
+            foregroundPID = -1;
+        }
+
+        return;
+    }
+    
+    // child process
+    if (!subshell) {
+        setpgid(0, 0);
+    }
+
+    // unblock the signals
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    
+    // reset the signal handlers
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+
+    // the cache builtin captures the output of the commands it runs
+    if (captureFds[0] != -1) {
+        dup2(captureFds[0], STDOUT_FILENO);
+        dup2(captureFds[1], STDERR_FILENO);
+    }
+
+    // execute the command with the prebuilt environment, only a command with assignments in front needs its own copy
+    char **envp = assignmentCount > 0 ? environmentWithAssignments(assignments, assignmentCount) : environment;
+    int checkValue = execvpe(toks[0], (char *const *) toks, envp);
+
+    if (checkValue == -1) {
+        // print the error message
+        char errorMessage[MAXLINE];
+        int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: cannot run %s\n", toks[0]);
+        write(STDERR_FILENO, errorMessage, errorMessageLength);
+        exit(127);
+    }
+
+}
+
+
+// helper function that tells a loop to stop: ctrl-c at the prompt, or a body whose last command was interrupted
+static bool loopInterrupted() {
+    return waitInterrupted || lastExitStatus == 128 + SIGINT;
+}
+
+// run one node: a command, or a loop running its body
+static void evalNode(struct node *node, bool bg) {
+    static struct tokenStorage storage;
+
+    if (node->type == NODE_COMMAND) {
+        expandTokens(node->toks, &storage, true);
+        eval(storage.toks, bg);
+        return;
+    }
+
+    if (node->type == NODE_REPEAT) {
+        waitInterrupted = 0;
+
+        for (long i = 0; i < node->count; i++) {
+            evalNodes(node + 1, node->span);
+            if (loopInterrupted()) break;
+        }
+        return;
+    }
+
+    // the words are expanded once, before the first iteration
+    struct tokenStorage words = {0};
+    expandTokens(node->toks, &words, false);
+    waitInterrupted = 0;
+
+    for (int i = 0; i < words.tokenCount; i++) {
+        setVariable(node->variable, strlen(node->variable), words.toks[i], false);
+        evalNodes(node + 1, node->span);
+        if (loopInterrupted()) break;
+    }
+
+    storageFree(&words);
+}
+
+// run a list of nodes joined by && and ||, a list ending with & runs in a background subshell
+void evalList(struct node *nodes, int nodeCount, bool bg) {
+
+    // a single background command is just a background job, anything else needs a subshell
+    if (bg && (nodeCount > 1 || nodes[0].type != NODE_COMMAND)) {
+        evalListInBackground(nodes, nodeCount);
+        return;
+    }
+
+    struct node *previous = NULL;
+
+    for (int i = 0; i < nodeCount; i += 1 + nodes[i].span) {
+
+        // short circuit on the status of the last command that ran
+        if (previous != NULL && previous->connector == CONNECT_AND && lastExitStatus != 0) {
+            previous = &nodes[i];
+            continue;
+        }
+        if (previous != NULL && previous->connector == CONNECT_OR && lastExitStatus == 0) {
+            previous = &nodes[i];
+            continue;
+        }
+
+        evalNode(&nodes[i], bg);
+        previous = &nodes[i];
+    }
+}
+
+// run a sequence of lists, like a whole line or a loop body
+void evalNodes(struct node *nodes, int nodeCount) {
+    int listStart = 0;
+
+    for (int i = 0; i < nodeCount; i += 1 + nodes[i].span) {
+        if (nodes[i].connector == CONNECT_END) {
+            evalList(nodes + listStart, i + 1 + nodes[i].span - listStart, nodes[i].background);
+            listStart = i + 1 + nodes[i].span;
+        }
+    }
+}
+
+// run a list of nodes in a forked copy of the shell, tracked as a single background job
+void evalListInBackground(struct node *nodes, int nodeCount) {
+
+    // check the process count
+    if (findFreeJobSlot() == -1) {
+        const char *msg = "ERROR: too many jobs\n";
+        write(STDERR_FILENO, msg, strlen(msg));
+        lastExitStatus = 1;
+        return;
+    }
+
+    processCount++;
+
+    // block any incoming signals using sigprocmask
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    pid_t pid = fork();
+
+    if (pid == -1) {
+        const char *msg = "ERROR: fork didn't work\n";
+        write(STDERR_FILENO, msg, strlen(msg));
+        lastExitStatus = 1;
+        processCount--;
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+        return;
+    }
+
+    if (pid != 0) {
+        // parent process
+        const char *commandName = nodes[0].type == NODE_FOR ? "for" : "repeat";
+
+        if (nodes[0].type == NODE_COMMAND) {
+            // skip any assignments in front of the command
+            int name = 0;
+            while (nodes[0].toks[name + 1] != NULL && isAssignment(nodes[0].toks[name])) {
+                name++;
+            }
+            commandName = nodes[0].toks[name];
+        }
+
+        printf("[%d] (%d)  running  %s\n", processCount, pid, commandName);
+        fflush(stdout);
+
+        addJob(processCount, pid, commandName, joinNodes(nodes, nodeCount));
+        lastExitStatus = 0;
+
+        // unblock the signals
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+        return;
+    }
+
+    // child process: becomes a quiet shell with an empty job table that exits with the list's status
+    setpgid(0, 0);
+    subshell = true;
+    memset(jobs, 0, sizeof(jobs));
+    processCount = 0;
+
+    // the subshell doesn't exec, so close-on-exec doesn't apply: close the coprocess pipes so coproc-close still gives EOF
+    for (int i = 0; i < MAXCOPROCS; i++) {
+        if (coprocs[i].name != NULL) {
+            closeCoprocess(i);
+        }
+    }
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+    evalList(nodes, nodeCount, false);
+    exit(lastExitStatus);
+}
+
+// helper function that returns the length of the operator at s, or 0 if there is none
+static int lexOperator(const char *s, enum lexKind *kind) {
+    if (s[0] == '&' && s[1] == '&') {
+        *kind = LEX_AND;
+        return 2;
+    }
+    if (s[0] == '|' && s[1] == '|') {
+        *kind = LEX_OR;
+        return 2;
+    }
+    if (s[0] == '&') {
+        *kind = LEX_BACKGROUND;
+        return 1;
+    }
+    if (s[0] == ';') {
+        *kind = LEX_SEMICOLON;
+        return 1;
+    }
+    // a single | is an ordinary character
+    return 0;
+}
+
+// split a line in place into words and operators, returns the number of tokens or -1 if there are too many
+static int tokenizeLine(char *s, struct lexToken *tokens, int maxTokens) {
+    static const char *operatorText[] = {"", ";", "&", "&&", "||"};
+    int count = 0;
+
+    while (true) {
+        while (*s == '\n' || *s == '\t' || *s == ' ') ++s;
+        if (*s == '\0') break;
+
+        if (count == maxTokens) {
+            return -1;
+        }
+
+        enum lexKind kind;
+        int operatorLength = lexOperator(s, &kind);
+
+        if (operatorLength > 0) {
+            tokens[count].text = operatorText[kind];
+            tokens[count++].kind = kind;
+            s += operatorLength;
+            continue;
+        }
+
+        tokens[count].text = s;
+        tokens[count++].kind = LEX_WORD;
+
+        while (strchr("\n\t ", *s) == NULL && lexOperator(s, &kind) == 0) ++s;
+        if (*s == '\0') break;
+
+        // an operator right after a word ends the word, so remember it before overwriting its first character
+        operatorLength = lexOperator(s, &kind);
+
+        if (operatorLength > 0) {
+            if (count == maxTokens) {
+                return -1;
+            }
+            tokens[count].text = operatorText[kind];
+            tokens[count++].kind = kind;
+            *s = '\0';
+            s += operatorLength;
+        } else {
+            *s++ = '\0';
+        }
+    }
+
+    return count;
+}
+
+static bool parserAtWord(struct parser *parser, const char *word) {
+    return parser->position < parser->tokenCount && parser->tokens[parser->position].kind == LEX_WORD &&
+           (word == NULL || strcmp(parser->tokens[parser->position].text, word) == 0);
+}
+
+static void parserError(struct parser *parser) {
+    if (parser->error) {
+        return;
+    }
+
+    char errorMessage[MAXLINE];
+    int errorMessageLength;
+    if (parser->position < parser->tokenCount) {
+        errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: syntax error near %s\n", parser->tokens[parser->position].text);
+    } else {
+        errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: syntax error at end of line\n");
+    }
+    write(STDERR_FILENO, errorMessage, errorMessageLength);
+    parser->error = true;
+}
+
+static struct node *parserAddNode(struct parser *parser, enum nodeType type) {
+    if (parser->nodeCount == parser->maxNodes) {
+        parserError(parser);
+        return NULL;
+    }
+
+    struct node *node = &parser->nodes[parser->nodeCount++];
+    memset(node, 0, sizeof(struct node));
+    node->type = type;
+    node->connector = CONNECT_END;
+    return node;
+}
+
+// collect words up to the next operator into a NULL terminated list in the parser's argv
+static const char **parseWords(struct parser *parser, const char *stopWord) {
+    const char **words = parser->argv + parser->argvCount;
+
+    while (parserAtWord(parser, NULL) && (stopWord == NULL || !parserAtWord(parser, stopWord))) {
+        if (parser->argvCount + 1 >= parser->maxArgv) {
+            parserError(parser);
+            return NULL;
+        }
+        parser->argv[parser->argvCount++] = parser->tokens[parser->position++].text;
+    }
+
+    parser->argv[parser->argvCount++] = NULL;
+    return words;
+}
+
+static void parseSequence(struct parser *parser, bool inBody);
+
+// parse a loop body: do ... done
+static void parseBody(struct parser *parser, int loopIndex) {
+    if (!parserAtWord(parser, "do")) {
+        parserError(parser);
+        return;
+    }
+    parser->position++;
+
+    parseSequence(parser, true);
+
+    if (!parserAtWord(parser, "done")) {
+        parserError(parser);
+        return;
+    }
+    parser->position++;
+
+    parser->nodes[loopIndex].span = parser->nodeCount - loopIndex - 1;
+}
+
+// parse one item of a list: for NAME in WORDS; do ...; done, repeat N (command | do ...; done), or a command
+// returns the index of its node, or -1
+static int parseItem(struct parser *parser) {
+    if (!parserAtWord(parser, NULL)) {
+        parserError(parser);
+        return -1;
+    }
+
+    int index = parser->nodeCount;
+
+    if (parserAtWord(parser, "for")) {
+        parser->position++;
+        struct node *node = parserAddNode(parser, NODE_FOR);
+
+        if (node == NULL || !parserAtWord(parser, NULL)) {
+            parserError(parser);
+            return -1;
+        }
+
+        const char *variable = parser->tokens[parser->position].text;
+        if (variableNameLength(variable) == 0 || variable[variableNameLength(variable)] != '\0') {
+            parserError(parser);
+            return -1;
+        }
+        node->variable = variable;
+        parser->position++;
+
+        if (!parserAtWord(parser, "in")) {
+            parserError(parser);
+            return -1;
+        }
+        parser->position++;
+
+        node->toks = parseWords(parser, NULL);
+
+        // the words end with a ;
+        if (parser->position >= parser->tokenCount || parser->tokens[parser->position].kind != LEX_SEMICOLON) {
+            parserError(parser);
+            return -1;
+        }
+        parser->position++;
+
+        parseBody(parser, index);
+        return parser->error ? -1 : index;
+    }
+
+    if (parserAtWord(parser, "repeat")) {
+        parser->position++;
+        struct node *node = parserAddNode(parser, NODE_REPEAT);
+
+        char *end = NULL;
+        if (node != NULL && parserAtWord(parser, NULL)) {
+            node->count = strtol(parser->tokens[parser->position].text, &end, 10);
+        }
+
+        if (node == NULL || end == NULL || *end != '\0' || end == parser->tokens[parser->position].text || node->count < 0) {
+            parserError(parser);
+            return -1;
+        }
+        parser->position++;
+
+        if (parserAtWord(parser, "do")) {
+            parseBody(parser, index);
+            return parser->error ? -1 : index;
+        }
+
+        // repeat N command repeats just that command
+        if (parseItem(parser) == -1) {
+            return -1;
+        }
+
+        parser->nodes[index].span = parser->nodeCount - index - 1;
+        return index;
+    }
+
+    struct node *node = parserAddNode(parser, NODE_COMMAND);
+
+    if (node == NULL) {
+        return -1;
+    }
+
+    node->toks = parseWords(parser, NULL);
+    return parser->error ? -1 : index;
+}
+
+// parse lists separated by ; and & until the end of the line, or the done that closes a loop body
+static void parseSequence(struct parser *parser, bool inBody) {
+    while (!parser->error && parser->position < parser->tokenCount) {
+
+        if (inBody && parserAtWord(parser, "done")) {
+            return;
+        }
+
+        // an empty command between two ;s does nothing
+        if (parser->tokens[parser->position].kind == LEX_SEMICOLON) {
+            parser->position++;
+            continue;
+        }
+
+        // a list of items joined by && and ||
+        int last = parseItem(parser);
+
+        while (last != -1 && parser->position < parser->tokenCount &&
+               (parser->tokens[parser->position].kind == LEX_AND || parser->tokens[parser->position].kind == LEX_OR)) {
+            parser->nodes[last].connector = parser->tokens[parser->position].kind == LEX_AND ? CONNECT_AND : CONNECT_OR;
+            parser->position++;
+            last = parseItem(parser);
+        }
+
+        if (last == -1) {
+            return;
+        }
+
+        if (parser->position < parser->tokenCount) {
+            enum lexKind kind = parser->tokens[parser->position].kind;
+
+            if (kind == LEX_BACKGROUND) {
+                parser->nodes[last].background = true;
+                parser->position++;
+            } else if (kind == LEX_SEMICOLON) {
+                parser->position++;
+            } else if (!(inBody && parserAtWord(parser, "done"))) {
+                parserError(parser);
+            }
+        }
+    }
+}
+
+void parse_and_eval(char *s) {
+    assert(s);
+    static struct lexToken tokens[MAXLINE+1];
+    static struct node nodes[MAXLINE+1];
+    static const char *argv[2 * MAXLINE + 2];
+
+    int tokenCount = tokenizeLine(s, tokens, MAXLINE+1);
+
+    if (tokenCount == -1) {
+        const char *msg = "ERROR: line too long\n";
+        write(STDERR_FILENO, msg, strlen(msg));
+        lastExitStatus = 2;
+        return;
+    }
+
+    struct parser parser = {tokens, tokenCount, 0, nodes, 0, MAXLINE+1, argv, 0, 2 * MAXLINE + 2, false};
+    parseSequence(&parser, false);
+
+    if (parser.error) {
+        lastExitStatus = 2;
+        return;
+    }
+
+    evalNodes(nodes, parser.nodeCount);
+}
 
 void prompt() {
     const char *prompt = "crash> ";
     ssize_t nbytes = write(STDOUT_FILENO, prompt, strlen(prompt));
 }
 
-int repl() {
-    char *buf = NULL;
-    size_t len = 0;
-    while (prompt(), getline(&buf, &len, stdin) != -1) {
-        parse_and_eval(buf);
+int repl() {
+    char *buf = NULL;
+    size_t len = 0;
+    while (prompt(), getline(&buf, &len, stdin) != -1) {
+        parse_and_eval(buf);
+    }
+
+    if (buf != NULL) free(buf);
+    if (ferror(stdin)) {
+        perror("ERROR");
+        return 1;
+    }
+    return 0;
+}
+
+
+// function to handle sigint signals
+void sigintHandler(int signal) {
+    // function to handle sigint signals
+    if (foregroundPID != -1) {
+        kill(-foregroundPID, SIGINT);
+    } else {
+        // no foreground job: let a blocking builtin like wait know it was interrupted
+        waitInterrupted = 1;
+    }
+}
+
+
+// function to handle sigquit signals
+void sigquitHandler(int signal) {
+    if (foregroundPID != -1) {
+        kill(-foregroundPID, SIGQUIT);
+    } else {
+        // no foreground job: exit crash as per spec
+        exit(0);
+    }
+}
+
+// function to handle sigtstp signals
+void sigtstpHandler(int signal) {
+    if (foregroundPID != -1) {
+        kill(-foregroundPID, SIGTSTP);
+    }
+}
+
+// function to handle sigchild signals
+
+void sigchildHandler(int signal) {
+    pid_t pid;
+    int status;
+
+    while (true) {
+
+        // send a signal to the process
+        pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED);
+        if (pid <= 0) {
+            break;
+        }
+
+        // find the live job with the same pid, a finished job kept in the table may have had the same pid before it wrapped
+        for (int i = 0; i < MAXJOBS; i++) {
+            if ((jobs[i].running || jobs[i].stopped) && jobs[i].pid == pid) {
+
+                int jobNumber = jobs[i].jobNumber;
+                char *commandName = jobs[i].commandName;
+
+                if (WIFSTOPPED(status)) {
+                    jobs[i].stopped = true;
+                    jobs[i].running = false;
+                    jobs[i].exitStatus = 128 + WSTOPSIG(status);
+
+                    signalMessage(jobNumber, pid, commandName, 2, -1);
+                } else if (WIFEXITED(status)) {
+                    jobs[i].running = false;
+                    jobs[i].stopped = false;
+
+                    int exitStatus = WEXITSTATUS(status);
+                    jobs[i].exitStatus = exitStatus;
+                    signalMessage(jobNumber, pid, commandName, 0, exitStatus);
+
+                    resolveDependencies(jobNumber, exitStatus);
+
+                } else if (WIFSIGNALED(status)) {
+                    jobs[i].running = false;
+                    jobs[i].stopped = false;
+
+                    int signalNumber = WTERMSIG(status);
+                    jobs[i].exitStatus = 128 + signalNumber;
+
+                    if (signalNumber == SIGKILL || signalNumber == SIGINT) {
+                        signalMessage(jobNumber, pid, commandName, 1, -1);
+                    } else {
+                        signalMessage(jobNumber, pid, commandName, 1, signalNumber);
+                    }
+
+                    resolveDependencies(jobNumber, jobs[i].exitStatus);
+                } else if (WIFCONTINUED(status)) {
+                    jobs[i].stopped = false;
+                    jobs[i].running = true;
+
+                    signalMessage(jobNumber, pid, commandName, 3, -1);
+                } else {
+                    jobs[i].running = false;
+                    jobs[i].stopped = false;
+
+                    signalMessage(jobNumber, pid, commandName, 0, -1);
+                }
+
+                publishJob(i);
+
+                break;
+            }
+        }
+    }
+}
+
+// function to print the job finished text in a signal safe way
+
+static void signalMessage(int jobNumber, pid_t pid, char *commandName, int exitStatus, int value) {
+
+    // a background subshell only reports through its own exit status
+    if (subshell) {
+        return;
+    }
+
+    char message[MAXLINE];
+    char pidString[10];
+    char jobNumberString[10];
+
+    // convert numbers to strings, a job that never got a process (a cancelled pending job) shows - like in jobs
+    int pidLength;
+    if (pid == 0) {
+        pidString[0] = '-';
+        pidLength = 1;
+    } else {
+        pidLength = intToStringLength(pid, pidString, 10);
+    }
+    int jobNumberLength = intToStringLength(jobNumber, jobNumberString, 10);
+    
+    int messageIndex = 0;
+
+    // build the message
+    message[messageIndex++] = '[';
+
+    // add the job number
+    for (int i = 0; i < jobNumberLength; i++) {
+        message[messageIndex++] = jobNumberString[i];
+    }
+
+    message[messageIndex++] = ']';
+    message[messageIndex++] = ' ';
+
+    message[messageIndex++] = '(';
+
+    // add the pid
+    for (int i = 0; i < pidLength; i++) {
+        message[messageIndex++] = pidString[i];
+    }
+
+    message[messageIndex++] = ')';
+    message[messageIndex++] = ' ';
+    message[messageIndex++] = ' ';
+
+    // check what the status is
+
+    // normal exit
+    if (exitStatus == 0) {
+        const char *finishedString = "finished";
+        for (int i = 0; finishedString[i] != '\0'; i++) {
+            message[messageIndex++] = finishedString[i];
+        }
+
+        message[messageIndex++] = ' ';
+        message[messageIndex++] = ' ';
+
+        if (value > 0) {
+
+            char valueString[10];
+            int valueLength = intToStringLength(value, valueString, sizeof(valueString));
+            for (int i = 0; i < valueLength; i++) {
+                message[messageIndex++] = valueString[i];
+            }
+        }
+    // signal termination
+    } else if (exitStatus == 1) {
+        const char *finishedString = "killed";
+        for (int i = 0; finishedString[i] != '\0'; i++) {
+            message[messageIndex++] = finishedString[i];
+        }
+
+        message[messageIndex++] = ' ';
+        message[messageIndex++] = ' ';
+
+        if (value > 0) {
+            char valueString[10];
+            int valueLength = intToStringLength(value, valueString, 10);
+            for (int i = 0; i < valueLength; i++) {
+                message[messageIndex++] = valueString[i];
+            }
+            message[messageIndex++] = ' ';
+            message[messageIndex++] = ' ';
+        }
+    } else if (exitStatus == 2) {
+        const char *finishedString = "suspended";
+        for (int i = 0; finishedString[i] != '\0'; i++) {
+            message[messageIndex++] = finishedString[i];
+        }
+
+        message[messageIndex++] = ' ';
+        message[messageIndex++] = ' ';
+    } else if (exitStatus == 3) {
+        const char *finishedString = "continued";
+        for (int i = 0; finishedString[i] != '\0'; i++) {
+            message[messageIndex++] = finishedString[i];
+        }
+
+        message[messageIndex++] = ' ';
+        message[messageIndex++] = ' ';
+    // a pending job was started
+    } else if (exitStatus == 4) {
+        const char *finishedString = "running";
+        for (int i = 0; finishedString[i] != '\0'; i++) {
+            message[messageIndex++] = finishedString[i];
+        }
+
+        message[messageIndex++] = ' ';
+        message[messageIndex++] = ' ';
+    // a pending job will never start
+    } else if (exitStatus == 5) {
+        const char *finishedString = "cancelled";
+        for (int i = 0; finishedString[i] != '\0'; i++) {
+            message[messageIndex++] = finishedString[i];
+        }
+
+        message[messageIndex++] = ' ';
+        message[messageIndex++] = ' ';
+    }
+
+    // add the command name
+    for (int i = 0; i < strlen(commandName); i++) {
+        message[messageIndex++] = commandName[i];
+    }
+
+    // add the newline
+    message[messageIndex++] = '\n';
+
+    // end the message
+    message[messageIndex] = '\0';
+
+    // write the message
+    write(STDOUT_FILENO, message, messageIndex);
+}
+
+// function to get the length of an integer in string form in a signal safe way
+static int intToStringLength(int number, char *buffer, int bufferLength) {
+    // use mod to repeatedly get the last digit
+
+    int i = 0;
+
+    if (number == 0) {
+        buffer[0] = '0';
+        buffer[1] = '\0';
+        return 1;
+    }
+
+    while (number > 0) {
+        buffer[i] = number % 10 + '0';
+        number = number / 10;
+        i++;
+    }
+
+    buffer[i] = '\0';
+
+    // reverse the string
+    int length = i;
+
+    for (int j = 0; j < length / 2; j++) {
+        char temp = buffer[j];
+        buffer[j] = buffer[length - j - 1];
+        buffer[length - j - 1] = temp;
+    }
+
+    return length;
+}
+
+// helper function that blocks until the job at jobIndex stops running, sleeping in sigsuspend
+// between child events instead of polling
+static void waitWhileRunning(int jobIndex) {
+    sigset_t mask;
+    sigset_t previousMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &previousMask);
+
+    sigset_t suspendMask = previousMask;
+    sigdelset(&suspendMask, SIGCHLD);
+
+    while (jobs[jobIndex].running) {
+        sigsuspend(&suspendMask);
+    }
+
+    sigprocmask(SIG_SETMASK, &previousMask, NULL);
+}
+
+// helper function that resolves a %N or PID argument to a job index for the builtin builtinName
+// running, stopped and pending jobs always match, includeFinished also lets finished jobs whose slot
+// hasn't been reused yet match so their exit status can be read
+// returns -1 after printing an error if there is no such job
+static int parseJobArgument(const char *argument, const char *builtinName, bool includeFinished) {
+
+    bool isJobNumber = argument[0] == '%';
+    const char *digits = isJobNumber ? argument + 1 : argument;
+
+    // check if the argument is an integer
+    bool validInteger = digits[0] != '\0';
+
+    for (int i = 0; digits[i] != '\0'; i++) {
+        if (digits[i] < '0' || digits[i] > '9') {
+            validInteger = false;
+            break;
+        }
+    }
+
+    int number = atoi(digits);
+
+    if (!validInteger || number < 1) {
+        char errorMessage[MAXLINE];
+        int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: bad argument for %s: %s\n", builtinName, argument);
+        write(STDERR_FILENO, errorMessage, errorMessageLength);
+        return -1;
+    }
+
+    // prefer a live job, falling back to a finished one
+    int jobIndex = -1;
+
+    for (int i = 0; i < MAXJOBS; i++) {
+        bool live = jobs[i].running || jobs[i].stopped || jobs[i].pending;
+
+        if (!live && (!includeFinished || jobs[i].pid == 0)) {
+            continue;
+        }
+
+        bool matches = isJobNumber ? jobs[i].jobNumber == number : jobs[i].pid == number;
+
+        if (matches && (jobIndex == -1 || live)) {
+            jobIndex = i;
+        }
+    }
+
+    if (jobIndex == -1) {
+        char errorMessage[MAXLINE];
+        int errorMessageLength;
+        if (isJobNumber) {
+            errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: no job %d\n", number);
+        } else {
+            errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: no PID %d\n", number);
+        }
+        write(STDERR_FILENO, errorMessage, errorMessageLength);
+        return -1;
+    }
+
+    return jobIndex;
+}
+
+// called from the reap path when a job finishes, starts (or cancels) the pending jobs that were waiting on it
+static void resolveDependencies(int jobNumber, int exitStatus) {
+    for (int i = 0; i < MAXJOBS; i++) {
+        if (!jobs[i].pending) {
+            continue;
+        }
+
+        bool dependsOnJob = false;
+
+        for (int j = 0; j < jobs[i].dependencyCount; j++) {
+            if (jobs[i].dependencies[j] == jobNumber) {
+                jobs[i].dependencies[j] = jobs[i].dependencies[--jobs[i].dependencyCount];
+                dependsOnJob = true;
+                break;
+            }
+        }
+
+        if (!dependsOnJob) {
+            continue;
+        }
+
+        if (exitStatus != 0) {
+            jobs[i].dependencyFailed = true;
+        }
+
+        if (jobs[i].dependencyCount == 0) {
+            startPendingJob(i);
+        }
+    }
+}
+
+// start a pending job whose dependencies are all done, must be called with SIGCHLD blocked
+// only uses async-signal-safe calls since it normally runs inside the SIGCHLD handler
+static void startPendingJob(int jobIndex) {
+
+    if (jobs[jobIndex].onlyOnSuccess && jobs[jobIndex].dependencyFailed) {
+        cancelPendingJob(jobIndex);
+        return;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == -1) {
+        cancelPendingJob(jobIndex);
+        return;
+    }
+
+    if (pid == 0) {
+        // child process
+        setpgid(0, 0);
+
+        // reset the signal handlers and the mask inherited from the handler
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+
+        sigset_t emptyMask;
+        sigemptyset(&emptyMask);
+        sigprocmask(SIG_SETMASK, &emptyMask, NULL);
+
+        // the environment is built on the stack, malloc isn't safe in a child forked from the handler
+        int assignmentCount = jobs[jobIndex].assignmentCount;
+        int environmentCount = 0;
+        while (environment[environmentCount] != NULL) {
+            environmentCount++;
+        }
+
+        char *envp[environmentCount + assignmentCount + 1];
+        fillEnvironment(envp, (const char **) jobs[jobIndex].argv, assignmentCount);
+
+        char **argv = jobs[jobIndex].argv + assignmentCount;
+        execvpe(argv[0], argv, envp);
+
+        const char *msg = "ERROR: cannot run pending job\n";
+        write(STDERR_FILENO, msg, strlen(msg));
+        _exit(127);
+    }
+
+    // parent process
+    setpgid(pid, pid);
+
+    jobs[jobIndex].pid = pid;
+    jobs[jobIndex].pending = false;
+    jobs[jobIndex].running = true;
+    jobs[jobIndex].startTime = time(NULL);
+    publishJob(jobIndex);
+
+    signalMessage(jobs[jobIndex].jobNumber, pid, jobs[jobIndex].commandName, 4, -1);
+}
+
+// drop a pending job that will never start, which in turn fails anything waiting on it
+static void cancelPendingJob(int jobIndex) {
+    jobs[jobIndex].pending = false;
+    jobs[jobIndex].exitStatus = 1;
+    publishJob(jobIndex);
+
+    signalMessage(jobs[jobIndex].jobNumber, 0, jobs[jobIndex].commandName, 5, -1);
+
+    resolveDependencies(jobs[jobIndex].jobNumber, 1);
+}
+
+// helper function that picks the slot for a new job: an unused slot, or else the one whose job finished first,
+// so the exit status of recently finished jobs stays around for wait and after
+static int findFreeJobSlot(void) {
+    int jobIndex = -1;
+
+    for (int i = 0; i < MAXJOBS; i++) {
+        if (jobs[i].running || jobs[i].stopped || jobs[i].pending) {
+            continue;
+        }
+
+        if (jobIndex == -1 || jobs[i].jobNumber < jobs[jobIndex].jobNumber) {
+            jobIndex = i;
+        }
+    }
+
+    return jobIndex;
+}
+
+// helper function that frees what a finished job left behind before its slot is reused
+static void releaseJobSlot(int jobIndex) {
+    free(jobs[jobIndex].commandName);
+    free(jobs[jobIndex].commandLine);
+
+    if (jobs[jobIndex].argv != NULL) {
+        for (int i = 0; jobs[jobIndex].argv[i] != NULL; i++) {
+            free(jobs[jobIndex].argv[i]);
+        }
+        free(jobs[jobIndex].argv);
+    }
+
+    memset(&jobs[jobIndex], 0, sizeof(struct job));
+}
+
+// send a signal to the whole process group of a job, falling back to just the job's process
+// if the child hasn't moved into its own group yet
+static void signalJob(int jobIndex, int signalNumber) {
+    if (kill(-jobs[jobIndex].pid, signalNumber) == -1) {
+        kill(jobs[jobIndex].pid, signalNumber);
+    }
+}
+
+// helper function that parses a signal given as a number, a name or a name with the SIG prefix
+// returns -1 if it isn't a signal we know
+static int parseSignal(const char *name) {
+    static const struct {
+        const char *name;
+        int number;
+    } signalNames[] = {
+        {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+        {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM},
+        {"TERM", SIGTERM}, {"CHLD", SIGCHLD}, {"CONT", SIGCONT}, {"STOP", SIGSTOP},
+        {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN}, {"TTOU", SIGTTOU}, {"WINCH", SIGWINCH},
+    };
+
+    if (name[0] >= '0' && name[0] <= '9') {
+        char *end;
+        long number = strtol(name, &end, 10);
+        return *end == '\0' && number < NSIG ? (int) number : -1;
+    }
+
+    if (strncmp(name, "SIG", 3) == 0) {
+        name += 3;
+    }
+
+    for (size_t i = 0; i < sizeof(signalNames) / sizeof(signalNames[0]); i++) {
+        if (strcmp(name, signalNames[i].name) == 0) {
+            return signalNames[i].number;
+        }
+    }
+
+    return -1;
+}
+
+// helper function that returns the index of the coprocess called name, or -1
+static int findCoprocess(const char *name) {
+    for (int i = 0; i < MAXCOPROCS; i++) {
+        if (coprocs[i].name != NULL && strcmp(coprocs[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// helper function that checks if the job of a coprocess is still alive, must be called with SIGCHLD blocked
+static bool coprocessRunning(int coprocIndex) {
+    for (int i = 0; i < MAXJOBS; i++) {
+        if ((jobs[i].running || jobs[i].stopped) && jobs[i].jobNumber == coprocs[coprocIndex].jobNumber) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// helper function that waits until a coprocess pipe is ready, returns false if ctrl+c interrupted the wait
+// SIGINT is only unblocked inside ppoll, so a ctrl+c between the waitInterrupted check and the sleep isn't lost
+static bool waitForCoprocess(int fd, short events) {
+    sigset_t mask;
+    sigset_t previousMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigprocmask(SIG_BLOCK, &mask, &previousMask);
+
+    sigset_t pollMask = previousMask;
+    sigdelset(&pollMask, SIGINT);
+
+    struct pollfd pollInfo = {fd, events, 0};
+    bool ready = false;
+
+    while (!waitInterrupted) {
+        int result = ppoll(&pollInfo, 1, NULL, &pollMask);
+
+        // on an error the read or write that follows reports it
+        if (result > 0 || (result == -1 && errno != EINTR)) {
+            ready = true;
+            break;
+        }
+    }
+
+    sigprocmask(SIG_SETMASK, &previousMask, NULL);
+    return ready;
+}
+
+// close the shell's ends of a finished coprocess's pipes and free its slot
+static void closeCoprocess(int coprocIndex) {
+    if (coprocs[coprocIndex].inputFd != -1) {
+        close(coprocs[coprocIndex].inputFd);
+    }
+    if (coprocs[coprocIndex].outputFd != -1) {
+        close(coprocs[coprocIndex].outputFd);
+    }
+
+    free(coprocs[coprocIndex].name);
+    coprocs[coprocIndex].name = NULL;
+}
+
+// create the shared-memory segment the job table is published in, crash works fine without it
+static void openJobSegment(void) {
+    crashShmName(jobSegmentName, sizeof(jobSegmentName), getpid());
+
+    int fd = shm_open(jobSegmentName, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return;
+    }
+
+    size_t size = sizeof(struct crashShmHeader) + MAXJOBS * sizeof(struct crashShmJob);
+
+    if (ftruncate(fd, size) == -1) {
+        close(fd);
+        shm_unlink(jobSegmentName);
+        return;
+    }
+
+    void *segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (segment == MAP_FAILED) {
+        shm_unlink(jobSegmentName);
+        return;
+    }
+
+    // the segment starts zeroed, so every job is CRASH_SHM_EMPTY
+    jobSegment = segment;
+    jobSegment->version = CRASH_SHM_VERSION;
+    jobSegment->jobCapacity = MAXJOBS;
+    jobSegment->shellPid = getpid();
+    __atomic_store_n(&jobSegment->magic, CRASH_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    atexit(closeJobSegment);
+}
+
+// remove the segment when crash exits
+static void closeJobSegment(void) {
+    // forked children run the atexit handlers too if exec fails
+    if (jobSegment != NULL && jobSegment->shellPid == getpid()) {
+        shm_unlink(jobSegmentName);
+    }
+}
+
+// copy one job into the shared-memory segment under the seqlock
+// async-signal-safe, and SIGCHLD is blocked while writing so the handler can't start a second writer
+static void publishJob(int jobIndex) {
+    if (jobSegment == NULL || subshell) {
+        return;
+    }
+
+    sigset_t mask;
+    sigset_t previousMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &previousMask);
+
+    struct crashShmJob *entry = &jobSegment->jobs[jobIndex];
+    uint32_t sequence = jobSegment->sequence;
+
+    __atomic_store_n(&jobSegment->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    entry->jobNumber = jobs[jobIndex].jobNumber;
+    entry->pid = jobs[jobIndex].pid;
+    entry->exitStatus = jobs[jobIndex].exitStatus;
+    entry->startTime = jobs[jobIndex].startTime;
+
+    if (jobs[jobIndex].running) {
+        entry->state = CRASH_SHM_RUNNING;
+    } else if (jobs[jobIndex].stopped) {
+        entry->state = CRASH_SHM_SUSPENDED;
+    } else if (jobs[jobIndex].pending) {
+        entry->state = CRASH_SHM_PENDING;
+    } else {
+        entry->state = CRASH_SHM_FINISHED;
+    }
+
+    int commandLength = 0;
+    const char *command = jobs[jobIndex].commandLine != NULL ? jobs[jobIndex].commandLine : "";
+
+    while (command[commandLength] != '\0' && commandLength < CRASH_SHM_COMMANDLEN - 1) {
+        entry->command[commandLength] = command[commandLength];
+        commandLength++;
+    }
+    entry->command[commandLength] = '\0';
+
+    __atomic_store_n(&jobSegment->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+    sigprocmask(SIG_SETMASK, &previousMask, NULL);
+}
+
+// helper function that records a new running job in the first free slot, returns its index or -1
+static int addJob(int jobNumber, pid_t pid, const char *commandName, char *commandLine) {
+
+    // prepare to add the job to the jobs array
+    struct job newJob;
+    memset(&newJob, 0, sizeof(newJob));
+    newJob.jobNumber = jobNumber;
+    newJob.pid = pid;
+    newJob.running = true;
+    newJob.stopped = false;
+    newJob.commandName = strdup(commandName);
+    newJob.commandLine = commandLine;
+    newJob.exitStatus = 0;
+
+    newJob.startTime = time(NULL);
+
+    // add the job to the jobs array
+    int jobIndex = findFreeJobSlot();
+
+    if (jobIndex != -1) {
+        releaseJobSlot(jobIndex);
+        jobs[jobIndex] = newJob;
+        publishJob(jobIndex);
+    }
+
+    return jobIndex;
+}
+
+// helper function that appends the text of a span of nodes to a buffer
+static void appendNodes(struct outputBuffer *line, struct node *nodes, int nodeCount) {
+    for (int i = 0; i < nodeCount; i += 1 + nodes[i].span) {
+        if (nodes[i].type == NODE_FOR) {
+            bufferPrintf(line, "for %s in", nodes[i].variable);
+            for (int j = 0; nodes[i].toks[j] != NULL; j++) {
+                bufferPrintf(line, " %s", nodes[i].toks[j]);
+            }
+            bufferPrintf(line, "; do ");
+            appendNodes(line, nodes + i + 1, nodes[i].span);
+            bufferPrintf(line, "; done");
+        } else if (nodes[i].type == NODE_REPEAT) {
+            bufferPrintf(line, "repeat %ld do ", nodes[i].count);
+            appendNodes(line, nodes + i + 1, nodes[i].span);
+            bufferPrintf(line, "; done");
+        } else {
+            char *commandLine = joinTokens(nodes[i].toks);
+            if (commandLine != NULL) {
+                bufferAppend(line, commandLine, strlen(commandLine));
+                free(commandLine);
+            }
+        }
+
+        bool last = i + 1 + nodes[i].span >= nodeCount;
+
+        if (nodes[i].connector == CONNECT_AND) {
+            bufferAppend(line, " && ", 4);
+        } else if (nodes[i].connector == CONNECT_OR) {
+            bufferAppend(line, " || ", 4);
+        } else if (nodes[i].background) {
+            bufferAppend(line, last ? " &" : " & ", last ? 2 : 3);
+        } else if (!last) {
+            bufferAppend(line, "; ", 2);
+        }
+    }
+}
+
+// helper function that joins a list of nodes back into a single line
+static char *joinNodes(struct node *nodes, int nodeCount) {
+    struct outputBuffer line = {NULL, 0, 0};
+
+    appendNodes(&line, nodes, nodeCount);
+
+    bufferAppend(&line, "", 1);
+    return line.data;
+}
+
+// helper function that returns how long the variable name at the start of s is, 0 if there is none
+static size_t variableNameLength(const char *s) {
+    size_t nameLength = 0;
+
+    while (s[nameLength] == '_' || (s[nameLength] >= 'a' && s[nameLength] <= 'z') ||
+           (s[nameLength] >= 'A' && s[nameLength] <= 'Z') || (nameLength > 0 && s[nameLength] >= '0' && s[nameLength] <= '9')) {
+        nameLength++;
+    }
+
+    return nameLength;
+}
+
+// helper function that checks if a token is a NAME=value assignment
+static bool isAssignment(const char *token) {
+    size_t nameLength = variableNameLength(token);
+    return nameLength > 0 && token[nameLength] == '=';
+}
+
+static struct variable *findVariable(const char *name, size_t nameLength) {
+    for (int i = 0; i < variableCount; i++) {
+        if (variables[i].nameLength == nameLength && strncmp(variables[i].name, name, nameLength) == 0) {
+            return &variables[i];
+        }
+    }
+
+    return NULL;
+}
+
+// helper function that returns the value of a shell variable, or NULL if it isn't set
+static const char *getVariable(const char *name, size_t nameLength) {
+    struct variable *variable = findVariable(name, nameLength);
+
+    if (variable == NULL) {
+        return NULL;
+    }
+
+    return variable->entry + nameLength + 1;
+}
+
+// set a shell variable, exported marks it for the environment (a variable is never unexported)
+// the entry buffer is reused when the new value fits, so a loop over an unexported variable doesn't allocate
+static void setVariable(const char *name, size_t nameLength, const char *value, bool exported) {
+    struct variable *variable = findVariable(name, nameLength);
+
+    if (variable == NULL) {
+        if (variableCount == variableCapacity) {
+            int newCapacity = variableCapacity == 0 ? 64 : variableCapacity * 2;
+            struct variable *newVariables = realloc(variables, newCapacity * sizeof(struct variable));
+            if (newVariables == NULL) {
+                return;
+            }
+            variables = newVariables;
+            variableCapacity = newCapacity;
+        }
+
+        char *variableName = strndup(name, nameLength);
+        if (variableName == NULL) {
+            return;
+        }
+
+        variable = &variables[variableCount++];
+        variable->name = variableName;
+        variable->nameLength = nameLength;
+        variable->entry = NULL;
+        variable->entryCapacity = 0;
+        variable->exported = false;
+    }
+
+    // the SIGCHLD handler can start pending jobs with the environment, so it can't see an exported entry half written
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    bool environmentChanged = exported && !variable->exported;
+    size_t entryLength = nameLength + 1 + strlen(value) + 1;
+    char *oldEntry = NULL;
+
+    // when the new value fits, an exported variable changes in place and the environment still points at it
+    if (entryLength > variable->entryCapacity) {
+        char *newEntry = malloc(entryLength);
+        if (newEntry == NULL) {
+            sigprocmask(SIG_UNBLOCK, &mask, NULL);
+            return;
+        }
+
+        memcpy(newEntry, name, nameLength);
+        newEntry[nameLength] = '=';
+
+        // the old entry may still be in the environment, so it's only freed once the environment stops pointing at it
+        oldEntry = variable->entry;
+        variable->entry = newEntry;
+        variable->entryCapacity = entryLength;
+        environmentChanged = environmentChanged || variable->exported;
+    }
+
+    memcpy(variable->entry + nameLength + 1, value, entryLength - nameLength - 1);
+    variable->exported = variable->exported || exported;
+
+    // while the environment is still the one crash started with, it holds copies that have to be replaced
+    if (environmentChanged || (variable->exported && environmentShared)) {
+        rebuildEnvironment();
+    }
+
+    free(oldEntry);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+}
+
+// remove a shell variable, taking it out of the environment if it was exported
+static void unsetVariable(const char *name) {
+    struct variable *variable = findVariable(name, strlen(name));
+
+    if (variable == NULL) {
+        return;
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    // move the last variable into the gap, the order doesn't matter
+    struct variable removed = *variable;
+    *variable = variables[--variableCount];
+
+    if (removed.exported) {
+        rebuildEnvironment();
+    }
+
+    free(removed.name);
+    free(removed.entry);
+
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+}
+
+// copy the environment crash was started with into exported variables, the environment itself is shared until it changes
+static void importEnvironment() {
+    environment = environ;
+    environmentShared = true;
+
+    for (int i = 0; environ[i] != NULL; i++) {
+        size_t nameLength = variableNameLength(environ[i]);
+
+        if (nameLength > 0 && environ[i][nameLength] == '=') {
+            // set it first and mark it afterwards, importing doesn't change the environment
+            setVariable(environ[i], nameLength, environ[i] + nameLength + 1, false);
+            findVariable(environ[i], nameLength)->exported = true;
+            continue;
+        }
+
+        // entries that aren't NAME=value with a valid name (e.g. BASH_FUNC_f%%=...) can't be expanded or changed,
+        // but they're kept as opaque exported entries so programs still get them after the environment is rebuilt
+        if (variableCount == variableCapacity) {
+            int newCapacity = variableCapacity == 0 ? 64 : variableCapacity * 2;
+            struct variable *newVariables = realloc(variables, newCapacity * sizeof(struct variable));
+            if (newVariables == NULL) {
+                continue;
+            }
+            variables = newVariables;
+            variableCapacity = newCapacity;
+        }
+
+        // the name is what comes before the =, an entry without one gets an empty name no lookup can match
+        const char *equals = strchr(environ[i], '=');
+        char *name = equals != NULL ? strndup(environ[i], equals - environ[i]) : strdup("");
+        char *entry = strdup(environ[i]);
+
+        if (name == NULL || entry == NULL) {
+            free(name);
+            free(entry);
+            continue;
+        }
+
+        struct variable *variable = &variables[variableCount++];
+        variable->name = name;
+        variable->nameLength = strlen(name);
+        variable->entry = entry;
+        variable->entryCapacity = strlen(entry) + 1;
+        variable->exported = true;
+    }
+}
+
+// rebuild the environment from the exported variables, called with SIGCHLD blocked
+// the entries are the variables' own buffers, so only the pointer array is allocated here
+static void rebuildEnvironment() {
+    int exportedCount = 0;
+
+    for (int i = 0; i < variableCount; i++) {
+        if (variables[i].exported) {
+            exportedCount++;
+        }
+    }
+
+    char **newEnvironment = malloc((exportedCount + 1) * sizeof(char *));
+    if (newEnvironment == NULL) {
+        return;
+    }
+
+    int position = 0;
+    for (int i = 0; i < variableCount; i++) {
+        if (variables[i].exported) {
+            newEnvironment[position++] = variables[i].entry;
+        }
+    }
+    newEnvironment[position] = NULL;
+
+    if (!environmentShared) {
+        free(environment);
+    }
+
+    environment = newEnvironment;
+    environmentShared = false;
+
+    // keep environ in step so execvpe searches the exported PATH
+    environ = environment;
+}
+
+// build the environment for a single command with NAME=value assignments in front of it, only called in the child
+static char **environmentWithAssignments(const char **assignments, int assignmentCount) {
+    int environmentCount = 0;
+    while (environment[environmentCount] != NULL) {
+        environmentCount++;
+    }
+
+    char **envp = malloc((environmentCount + assignmentCount + 1) * sizeof(char *));
+    if (envp == NULL) {
+        return environment;
+    }
+
+    fillEnvironment(envp, assignments, assignmentCount);
+    return envp;
+}
+
+// fill envp, which has room for the environment plus assignmentCount more entries, with the environment and the
+// assignments on top of it, doesn't allocate so a child forked in the SIGCHLD handler can use it
+static void fillEnvironment(char **envp, const char **assignments, int assignmentCount) {
+    int environmentCount = 0;
+    while (environment[environmentCount] != NULL) {
+        envp[environmentCount] = environment[environmentCount];
+        environmentCount++;
+    }
+
+    for (int i = 0; i < assignmentCount; i++) {
+        size_t nameLength = variableNameLength(assignments[i]);
+        int j = 0;
+
+        // an assignment replaces the exported value of the same name
+        while (j < environmentCount && !(strncmp(envp[j], assignments[i], nameLength + 1) == 0)) {
+            j++;
+        }
+
+        envp[j] = (char *) assignments[i];
+        if (j == environmentCount) {
+            environmentCount++;
+        }
+    }
+
+    envp[environmentCount] = NULL;
+
+    // execvpe searches the PATH of environ
+    environ = envp;
+}
+
+// forget the tokens in storage, keeping its memory for the next command
+static void storageReset(struct tokenStorage *storage) {
+    storage->tokenCount = 0;
+
+    for (struct textChunk *chunk = storage->chunks; chunk != NULL; chunk = chunk->next) {
+        chunk->used = 0;
+    }
+
+    storage->currentChunk = storage->chunks;
+}
+
+// free everything a storage holds
+static void storageFree(struct tokenStorage *storage) {
+    struct textChunk *chunk = storage->chunks;
+
+    while (chunk != NULL) {
+        struct textChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(storage->toks);
+    memset(storage, 0, sizeof(struct tokenStorage));
+}
+
+// allocate text in storage, the memory stays valid until the next storageReset
+static char *storageAlloc(struct tokenStorage *storage, size_t length) {
+    struct textChunk *chunk = storage->currentChunk;
+
+    // move on to the next chunk that has room, adding one if there is none
+    while (chunk != NULL && chunk->used + length > chunk->size) {
+        if (chunk->next == NULL) {
+            break;
+        }
+        chunk = chunk->next;
+    }
+
+    if (chunk == NULL || chunk->used + length > chunk->size) {
+        size_t size = length > 65536 ? length : 65536;
+        struct textChunk *newChunk = malloc(sizeof(struct textChunk) + size);
+
+        if (newChunk == NULL) {
+            return NULL;
+        }
+
+        newChunk->next = NULL;
+        newChunk->used = 0;
+        newChunk->size = size;
+
+        if (chunk == NULL) {
+            storage->chunks = newChunk;
+        } else {
+            chunk->next = newChunk;
+        }
+
+        chunk = newChunk;
+    }
+
+    storage->currentChunk = chunk;
+    char *text = chunk->data + chunk->used;
+    chunk->used += length;
+    return text;
+}
+
+// append a token to storage, keeping the list NULL terminated
+static void storagePush(struct tokenStorage *storage, const char *token) {
+    if (storage->tokenCount + 2 > storage->tokenCapacity) {
+        int newCapacity = storage->tokenCapacity == 0 ? MAXLINE : storage->tokenCapacity * 2;
+        const char **newToks = realloc(storage->toks, newCapacity * sizeof(char *));
+
+        if (newToks == NULL) {
+            return;
+        }
+
+        storage->toks = newToks;
+        storage->tokenCapacity = newCapacity;
+    }
+
+    storage->toks[storage->tokenCount++] = token;
+    storage->toks[storage->tokenCount] = NULL;
+}
+
+// helper function that finds the variable reference at s ($?, $NAME or ${NAME})
+// returns how many characters it takes up, or 0 if s isn't a reference, and sets value to what it expands to
+static int variableReference(const char *s, const char **value, char *statusBuffer, int statusBufferLength) {
+    if (s[0] != '$') {
+        return 0;
+    }
+
+    if (s[1] == '?') {
+        snprintf(statusBuffer, statusBufferLength, "%d", lastExitStatus);
+        *value = statusBuffer;
+        return 2;
+    }
+
+    bool braces = s[1] == '{';
+    const char *name = s + 1 + braces;
+    size_t nameLength = variableNameLength(name);
+
+    if (nameLength == 0 || (braces && name[nameLength] != '}')) {
+        return 0;
+    }
+
+    *value = getVariable(name, nameLength);
+    if (*value == NULL) {
+        *value = "";
+    }
+
+    return 1 + braces + nameLength + braces;
+}
+
+// helper function that expands the variable references in a token into text allocated in storage
+static const char *expandVariables(const char *token, struct tokenStorage *storage) {
+    char status[12];
+    const char *value;
+
+    // measure first so the expansion is a single allocation
+    size_t expandedLength = 0;
+
+    for (const char *c = token; *c != '\0';) {
+        int referenceLength = variableReference(c, &value, status, sizeof(status));
+
+        if (referenceLength > 0) {
+            expandedLength += strlen(value);
+            c += referenceLength;
+        } else {
+            expandedLength++;
+            c++;
+        }
+    }
+
+    char *expanded = storageAlloc(storage, expandedLength + 1);
+    if (expanded == NULL) {
+        return token;
+    }
+
+    size_t position = 0;
+
+    for (const char *c = token; *c != '\0';) {
+        int referenceLength = variableReference(c, &value, status, sizeof(status));
+
+        if (referenceLength > 0) {
+            size_t valueLength = strlen(value);
+            memcpy(expanded + position, value, valueLength);
+            position += valueLength;
+            c += referenceLength;
+        } else {
+            expanded[position++] = *c++;
+        }
+    }
+
+    expanded[position] = '\0';
+    return expanded;
+}
+
+// helper function that expands variables and globs in the tokens of a command into storage
+// tokens without anything to expand are passed through without copying
+static void expandTokens(const char **toks, struct tokenStorage *storage, bool command) {
+    storageReset(storage);
+
+    // make sure the token list exists even for a command that expands to nothing
+    storagePush(storage, NULL);
+    storage->tokenCount = 0;
+
+    // still in the assignments and name at the front of a command, which are never globbed
+    bool literal = command;
+
+    for (int t = 0; toks[t] != NULL; t++) {
+        const char *token = toks[t];
+
+        if (strchr(token, '$') != NULL) {
+            token = expandVariables(token, storage);
+
+            // a word made up of unset or empty variables goes away instead of becoming an empty argument
+            if (token[0] == '\0') {
+                continue;
+            }
+        }
+
+        bool glob = !literal;
+        if (literal && !isAssignment(token)) {
+            literal = false;
+        }
+
+        // a pattern that matches nothing is kept as is
+        if (glob && strpbrk(token, "*?[") != NULL && expandGlob(token, storage) > 0) {
+            continue;
+        }
+
+        storagePush(storage, token);
+    }
+}
+
+// directories listed recently, replaced round robin
+static struct directoryListing listingCache[LISTINGCACHESIZE];
+static int nextListing = 0;
+
+// helper function that reads a directory with getdents64, reusing the cached listing while the directory is unchanged
+static struct directoryListing *listDirectory(const char *path) {
+    static char *direntBuffer = NULL;
+
+    struct stat directoryInfo;
+    if (stat(path, &directoryInfo) == -1 || !S_ISDIR(directoryInfo.st_mode)) {
+        return NULL;
+    }
+
+    time_t now = time(NULL);
+
+    for (int i = 0; i < LISTINGCACHESIZE; i++) {
+        struct directoryListing *listing = &listingCache[i];
+
+        if (listing->path != NULL && strcmp(listing->path, path) == 0 && listing->device == directoryInfo.st_dev &&
+            listing->inode == directoryInfo.st_ino && listing->modified.tv_sec == directoryInfo.st_mtim.tv_sec &&
+            listing->modified.tv_nsec == directoryInfo.st_mtim.tv_nsec && now - listing->readAt < LISTINGCACHETTL) {
+            return listing;
+        }
+    }
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    if (direntBuffer == NULL) {
+        direntBuffer = malloc(DIRENTBUFFER);
+        if (direntBuffer == NULL) {
+            close(fd);
+            return NULL;
+        }
+    }
+
+    // reuse the oldest cache slot, keeping its arrays
+    struct directoryListing *listing = &listingCache[nextListing];
+    nextListing = (nextListing + 1) % LISTINGCACHESIZE;
+
+    free(listing->path);
+    listing->path = strdup(path);
+    listing->device = directoryInfo.st_dev;
+    listing->inode = directoryInfo.st_ino;
+    listing->modified = directoryInfo.st_mtim;
+    listing->readAt = now;
+    listing->namesLength = 0;
+    listing->entryCount = 0;
+
+    while (true) {
+        long length = syscall(SYS_getdents64, fd, direntBuffer, DIRENTBUFFER);
+
+        if (length <= 0) {
+            break;
+        }
+
+        for (long offset = 0; offset < length;) {
+            // struct linux_dirent64: inode, offset, record length, type, name
+            unsigned short recordLength;
+            memcpy(&recordLength, direntBuffer + offset + 16, sizeof(recordLength));
+            unsigned char type = direntBuffer[offset + 18];
+            const char *name = direntBuffer + offset + 19;
+            offset += recordLength;
+
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+                continue;
+            }
+
+            size_t nameLength = strlen(name) + 1;
+
+            if (listing->entryCount == listing->entryCapacity) {
+                int newCapacity = listing->entryCapacity == 0 ? 1024 : listing->entryCapacity * 2;
+                size_t *newOffsets = realloc(listing->nameOffsets, newCapacity * sizeof(size_t));
+                unsigned char *newTypes = realloc(listing->types, newCapacity);
+
+                if (newOffsets != NULL) {
+                    listing->nameOffsets = newOffsets;
+                }
+                if (newTypes != NULL) {
+                    listing->types = newTypes;
+                }
+                if (newOffsets == NULL || newTypes == NULL) {
+                    break;
+                }
+                listing->entryCapacity = newCapacity;
+            }
+
+            if (listing->namesLength + nameLength > listing->namesCapacity) {
+                size_t newCapacity = listing->namesCapacity == 0 ? 65536 : listing->namesCapacity * 2;
+                while (newCapacity < listing->namesLength + nameLength) {
+                    newCapacity *= 2;
+                }
+
+                char *newNames = realloc(listing->names, newCapacity);
+                if (newNames == NULL) {
+                    break;
+                }
+                listing->names = newNames;
+                listing->namesCapacity = newCapacity;
+            }
+
+            memcpy(listing->names + listing->namesLength, name, nameLength);
+            listing->nameOffsets[listing->entryCount] = listing->namesLength;
+            listing->types[listing->entryCount] = type;
+            listing->namesLength += nameLength;
+            listing->entryCount++;
+        }
+    }
+
+    close(fd);
+    return listing;
+}
+
+// helper function that matches a single path component against a glob pattern with *, ? and [...]
+// the pattern ends at the first '/' or the end of the string
+static bool globMatch(const char *pattern, const char *name) {
+    const char *starPattern = NULL;
+    const char *starName = NULL;
+
+    // a leading dot is only matched explicitly
+    if (name[0] == '.' && pattern[0] != '.') {
+        return false;
+    }
+
+    while (*name != '\0') {
+        bool matched = false;
+        const char *next = pattern + 1;
+
+        if (*pattern == '*') {
+            // remember where the star was so we can backtrack and let it eat one more character
+            starPattern = pattern++;
+            starName = name;
+            continue;
+        } else if (*pattern == '?') {
+            matched = true;
+        } else if (*pattern == '[') {
+            const char *c = pattern + 1;
+            bool negate = *c == '!' || *c == '^';
+            if (negate) {
+                c++;
+            }
+
+            bool inSet = false;
+            bool first = true;
+
+            while (*c != '\0' && *c != '/' && (*c != ']' || first)) {
+                if (c[1] == '-' && c[2] != ']' && c[2] != '\0' && c[2] != '/') {
+                    if (*c <= *name && *name <= c[2]) {
+                        inSet = true;
+                    }
+                    c += 3;
+                } else {
+                    if (*c == *name) {
+                        inSet = true;
+                    }
+                    c++;
+                }
+                first = false;
+            }
+
+            if (*c == ']') {
+                matched = inSet != negate;
+                next = c + 1;
+            } else {
+                // no closing bracket, the [ is an ordinary character
+                matched = *name == '[';
+            }
+        } else if (*pattern != '\0' && *pattern != '/') {
+            matched = *pattern == *name;
+        }
+
+        if (matched) {
+            pattern = next;
+            name++;
+        } else if (starPattern != NULL) {
+            pattern = starPattern + 1;
+            name = ++starName;
+        } else {
+            return false;
+        }
+    }
+
+    while (*pattern == '*') {
+        pattern++;
+    }
+
+    return *pattern == '\0' || *pattern == '/';
+}
+
+static int comparePaths(const void *a, const void *b) {
+    return strcmp(*(const char **) a, *(const char **) b);
+}
+
+// helper function that joins a directory and a name into text allocated in storage
+static char *joinPath(struct tokenStorage *storage, const char *directory, const char *name, size_t nameLength) {
+    size_t directoryLength = strlen(directory);
+    bool needsSlash = directoryLength > 0 && directory[directoryLength - 1] != '/';
+    char *path = storageAlloc(storage, directoryLength + needsSlash + nameLength + 1);
+
+    if (path == NULL) {
+        return NULL;
+    }
+
+    memcpy(path, directory, directoryLength);
+    if (needsSlash) {
+        path[directoryLength] = '/';
+    }
+    memcpy(path + directoryLength + needsSlash, name, nameLength);
+    path[directoryLength + needsSlash + nameLength] = '\0';
+    return path;
+}
+
+// expand a glob pattern one path component at a time, appending the sorted matches to storage
+// returns the number of matches
+static int expandGlob(const char *pattern, struct tokenStorage *storage) {
+
+    // the paths matched so far, starting from the root or the current directory
+    int pathCount = 1;
+    int pathCapacity = 16;
+    const char **paths = malloc(pathCapacity * sizeof(char *));
+
+    if (paths == NULL) {
+        return 0;
+    }
+
+    paths[0] = pattern[0] == '/' ? "/" : "";
+    bool needsExistenceCheck = false;
+
+    // a pattern ending in / only matches directories, and keeps the slash
+    size_t patternLength = strlen(pattern);
+    bool directoriesOnly = patternLength > 0 && pattern[patternLength - 1] == '/';
+
+    const char *component = pattern;
+
+    while (*component == '/') {
+        component++;
+    }
+
+    while (*component != '\0' && pathCount > 0) {
+        const char *componentEnd = strchr(component, '/');
+        if (componentEnd == NULL) {
+            componentEnd = component + strlen(component);
+        }
+
+        size_t componentLength = componentEnd - component;
+        const char *nextComponent = componentEnd;
+        while (*nextComponent == '/') {
+            nextComponent++;
+        }
+        bool lastComponent = *nextComponent == '\0';
+
+        bool magic = false;
+        for (size_t i = 0; i < componentLength; i++) {
+            if (component[i] == '*' || component[i] == '?' || component[i] == '[') {
+                magic = true;
+            }
+        }
+
+        // matches come from real directory entries, but literal components after them are only checked at the end
+        needsExistenceCheck = !magic;
+
+        int newCount = 0;
+        int newCapacity = 16;
+        const char **newPaths = malloc(newCapacity * sizeof(char *));
+
+        if (newPaths == NULL) {
+            free(paths);
+            return 0;
+        }
+
+        for (int p = 0; p < pathCount; p++) {
+
+            // literal components are appended without listing the directory, and checked once at the end
+            if (!magic) {
+                const char *path = joinPath(storage, paths[p], component, componentLength);
+
+                if (path != NULL) {
+                    if (newCount == newCapacity) {
+                        newCapacity *= 2;
+                        newPaths = realloc(newPaths, newCapacity * sizeof(char *));
+                    }
+                    newPaths[newCount++] = path;
+                }
+                continue;
+            }
+
+            struct directoryListing *listing = listDirectory(paths[p][0] == '\0' ? "." : paths[p]);
+
+            if (listing == NULL) {
+                continue;
+            }
+
+            for (int e = 0; e < listing->entryCount; e++) {
+                const char *name = listing->names + listing->nameOffsets[e];
+
+                if (!globMatch(component, name)) {
+                    continue;
+                }
+
+                const char *path = joinPath(storage, paths[p], name, strlen(name));
+
+                if (path == NULL) {
+                    continue;
+                }
+
+                // only directories can hold the rest of the pattern
+                if ((!lastComponent || directoriesOnly) && listing->types[e] != DT_DIR) {
+                    struct stat pathInfo;
+                    if (listing->types[e] != DT_LNK && listing->types[e] != DT_UNKNOWN) {
+                        continue;
+                    }
+                    if (stat(path, &pathInfo) == -1 || !S_ISDIR(pathInfo.st_mode)) {
+                        continue;
+                    }
+                }
+
+                if (newCount == newCapacity) {
+                    newCapacity *= 2;
+                    newPaths = realloc(newPaths, newCapacity * sizeof(char *));
+                }
+                newPaths[newCount++] = path;
+            }
+        }
+
+        free(paths);
+        paths = newPaths;
+        pathCount = newCount;
+        component = nextComponent;
+    }
+
+    int matchCount = 0;
+
+    if (pathCount > 0) {
+        qsort(paths, pathCount, sizeof(char *), comparePaths);
+
+        for (int p = 0; p < pathCount; p++) {
+            struct stat pathInfo;
+            if (needsExistenceCheck && lstat(paths[p], &pathInfo) == -1) {
+                continue;
+            }
+            if (needsExistenceCheck && directoriesOnly && (stat(paths[p], &pathInfo) == -1 || !S_ISDIR(pathInfo.st_mode))) {
+                continue;
+            }
+
+            const char *path = directoriesOnly ? joinPath(storage, paths[p], "", 0) : paths[p];
+            if (path == NULL) {
+                continue;
+            }
+
+            storagePush(storage, path);
+            matchCount++;
+        }
+    }
+
+    free(paths);
+    return matchCount;
+}
+
+// helper function that returns the sample for pid, opening its /proc files the first time it is seen
+static struct processSample *findProcessSample(pid_t pid) {
+    for (int i = 0; i < sampleCount; i++) {
+        if (samples[i].pid == pid) {
+            return &samples[i];
+        }
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int statFd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (statFd == -1) {
+        return NULL;
+    }
+
+    if (sampleCount == sampleCapacity) {
+        int newCapacity = sampleCapacity == 0 ? 64 : sampleCapacity * 2;
+        struct processSample *newSamples = realloc(samples, newCapacity * sizeof(struct processSample));
+        if (newSamples == NULL) {
+            close(statFd);
+            return NULL;
+        }
+        samples = newSamples;
+        sampleCapacity = newCapacity;
+    }
+
+    struct processSample *sample = &samples[sampleCount++];
+    sample->pid = pid;
+    sample->statFd = statFd;
+    snprintf(path, sizeof(path), "/proc/%d/statm", pid);
+    sample->statmFd = open(path, O_RDONLY | O_CLOEXEC);
+    snprintf(path, sizeof(path), "/proc/%d/io", pid);
+    sample->ioFd = open(path, O_RDONLY | O_CLOEXEC);
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/children", pid, pid);
+    sample->childrenFd = open(path, O_RDONLY | O_CLOEXEC);
+    sample->cpuTicks = 0;
+    sample->fresh = true;
+    sample->seen = false;
+
+    return sample;
+}
+
+// helper function that reads a whole /proc file from the start with pread, returns the length or -1
+static int readProcFile(int fd, char *buffer, int bufferLength) {
+    if (fd == -1) {
+        return -1;
+    }
+
+    ssize_t length = pread(fd, buffer, bufferLength - 1, 0);
+
+    if (length < 0) {
+        return -1;
+    }
+
+    buffer[length] = '\0';
+    return length;
+}
+
+// add the usage of pid and of its descendants in the process group pgid to usage
+static void sampleProcessTree(pid_t pid, pid_t pgid, struct jobUsage *usage, bool leader, int depth) {
+    struct processSample *sample = findProcessSample(pid);
+
+    if (sample == NULL || sample->seen || depth > 32) {
+        return;
+    }
+
+    char buffer[4096];
+
+    if (readProcFile(sample->statFd, buffer, sizeof(buffer)) <= 0) {
+        return;
+    }
+
+    // the command name can contain spaces and parentheses, so the fields start after the last ')'
+    char *fields = strrchr(buffer, ')');
+    if (fields == NULL) {
+        return;
+    }
+
+    char state;
+    int processGroup;
+    unsigned long long userTicks;
+    unsigned long long systemTicks;
+
+    if (sscanf(fields + 2, "%c %*d %d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &state, &processGroup, &userTicks, &systemTicks) != 4) {
+        return;
+    }
+
+    // children that moved to a process group of their own aren't part of the job
+    if (!leader && processGroup != pgid) {
+        return;
+    }
+
+    sample->seen = true;
+
+    // a process we haven't sampled before only counts from now on
+    usage->previousCpuTicks += sample->fresh ? userTicks + systemTicks : sample->cpuTicks;
+    sample->cpuTicks = userTicks + systemTicks;
+    sample->fresh = false;
+    usage->cpuTicks += sample->cpuTicks;
+
+    if (leader) {
+        usage->state = state;
+    }
+
+    unsigned long long residentPages;
+    if (readProcFile(sample->statmFd, buffer, sizeof(buffer)) > 0 && sscanf(buffer, "%*u %llu", &residentPages) == 1) {
+        usage->residentBytes += residentPages * sysconf(_SC_PAGESIZE);
+    }
+
+    if (readProcFile(sample->ioFd, buffer, sizeof(buffer)) > 0) {
+        char *readLine = strstr(buffer, "\nread_bytes: ");
+        char *writeLine = strstr(buffer, "\nwrite_bytes: ");
+
+        if (readLine != NULL && writeLine != NULL) {
+            usage->readBytes += strtoull(readLine + 13, NULL, 10);
+            usage->writeBytes += strtoull(writeLine + 14, NULL, 10);
+            usage->hasIO = true;
+        }
+    }
+
+    // follow the children listed by the kernel
+    if (readProcFile(sample->childrenFd, buffer, sizeof(buffer)) > 0) {
+        char *next = buffer;
+
+        while (*next != '\0') {
+            char *end;
+            long child = strtol(next, &end, 10);
+
+            if (end == next) {
+                break;
+            }
+
+            sampleProcessTree(child, pgid, usage, false, depth + 1);
+            next = end;
+        }
+    }
+}
+
+// helper function that renders a byte count in a short human readable form
+static void formatBytes(unsigned long long bytes, char *buffer, int bufferLength) {
+    const char *units = "BKMGT";
+    double value = bytes;
+    int unit = 0;
+
+    while (value >= 1024 && units[unit + 1] != '\0') {
+        value /= 1024;
+        unit++;
+    }
+
+    if (unit == 0) {
+        snprintf(buffer, bufferLength, "%lluB", bytes);
+    } else {
+        snprintf(buffer, bufferLength, "%.1f%c", value, units[unit]);
+    }
+}
+
+// jobs --watch [interval [count]]: refresh a view of the CPU, memory and IO of every job from /proc every
+// interval seconds (1 by default) until ctrl+c, or count times
+static void watchJobs(const char **args) {
+
+    double interval = 1.0;
+    long count = -1;
+
+    if (args[0] != NULL) {
+        char *end;
+        interval = strtod(args[0], &end);
+
+        if (*end != '\0' || interval <= 0) {
+            char errorMessage[MAXLINE];
+            int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: bad argument for jobs: %s\n", args[0]);
+            write(STDERR_FILENO, errorMessage, errorMessageLength);
+            lastExitStatus = 1;
+            return;
+        }
+
+        if (args[1] != NULL) {
+            count = strtol(args[1], &end, 10);
+
+            if (*end != '\0' || count < 1 || args[2] != NULL) {
+                char errorMessage[MAXLINE];
+                int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: bad argument for jobs: %s\n", args[1]);
+                write(STDERR_FILENO, errorMessage, errorMessageLength);
+                lastExitStatus = 1;
+                return;
+            }
+        }
+    }
+
+    bool clearScreen = isatty(STDOUT_FILENO);
+    long ticksPerSecond = sysconf(_SC_CLK_TCK);
+
+    struct timespec previousTime;
+    clock_gettime(CLOCK_MONOTONIC, &previousTime);
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+
+    // SIGINT is only unblocked while sleeping in ppoll, so a ctrl+c between the waitInterrupted check and the sleep isn't lost
+    sigset_t interruptMask;
+    sigset_t previousMask;
+    sigemptyset(&interruptMask);
+    sigaddset(&interruptMask, SIGINT);
+    sigprocmask(SIG_BLOCK, &interruptMask, &previousMask);
+
+    sigset_t sleepMask = previousMask;
+    sigdelset(&sleepMask, SIGINT);
+
+    waitInterrupted = 0;
+
+    // frame -1 only takes the baseline sample the first CPU% is measured against
+    for (long frame = -1; count == -1 || frame < count; frame++) {
+
+        // sleep for the interval, SIGCHLD can cut it short so keep going until the deadline
+        struct timespec deadline = previousTime;
+        deadline.tv_sec += (time_t) interval;
+        deadline.tv_nsec += (long) ((interval - (double) (time_t) interval) * 1e9);
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (frame >= 0 && !waitInterrupted) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+
+            struct timespec remaining;
+            remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+            remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (remaining.tv_nsec < 0) {
+                remaining.tv_sec--;
+                remaining.tv_nsec += 1000000000L;
+            }
+            if (remaining.tv_sec < 0) {
+                break;
+            }
+
+            ppoll(NULL, 0, &remaining, &sleepMask);
+        }
+
+        if (waitInterrupted) {
+            break;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double elapsed = (now.tv_sec - previousTime.tv_sec) + (now.tv_nsec - previousTime.tv_nsec) / 1e9;
+        previousTime = now;
+
+        // mask the signals while reading the job table
+        sigprocmask(SIG_BLOCK, &mask, NULL);
+
+        for (int i = 0; i < sampleCount; i++) {
+            samples[i].seen = false;
+        }
+
+        jobsOutput.length = 0;
+
+        if (clearScreen) {
+            bufferAppend(&jobsOutput, "\033[H\033[2J", 7);
+        }
+
+        bufferPrintf(&jobsOutput, "%-6s %-8s %-5s %6s %8s %8s %8s  %s\n", "JOB", "PID", "STATE", "CPU%", "RSS", "READ", "WRITE", "COMMAND");
+
+        for (int i = 0; i < MAXJOBS; i++) {
+            if (!jobs[i].running && !jobs[i].stopped) {
+                continue;
+            }
+
+            struct jobUsage usage;
+            memset(&usage, 0, sizeof(usage));
+            usage.state = '?';
+
+            sampleProcessTree(jobs[i].pid, jobs[i].pid, &usage, true, 0);
+
+            double cpuPercent = 0;
+            if (elapsed > 0 && usage.cpuTicks >= usage.previousCpuTicks) {
+                cpuPercent = (usage.cpuTicks - usage.previousCpuTicks) * 100.0 / (ticksPerSecond * elapsed);
+            }
+
+            char jobString[16];
+            char residentString[16];
+            char readString[16];
+            char writeString[16];
+            snprintf(jobString, sizeof(jobString), "[%d]", jobs[i].jobNumber);
+            formatBytes(usage.residentBytes, residentString, sizeof(residentString));
+            formatBytes(usage.readBytes, readString, sizeof(readString));
+            formatBytes(usage.writeBytes, writeString, sizeof(writeString));
+
+            bufferPrintf(&jobsOutput, "%-6s %-8d %-5c %6.1f %8s %8s %8s  %s\n", jobString, jobs[i].pid, usage.state, cpuPercent,
+                         residentString, usage.hasIO ? readString : "-", usage.hasIO ? writeString : "-", jobs[i].commandLine);
+        }
+
+        // forget the processes that are gone
+        int kept = 0;
+
+        for (int i = 0; i < sampleCount; i++) {
+            if (samples[i].seen) {
+                samples[kept++] = samples[i];
+                continue;
+            }
+
+            close(samples[i].statFd);
+            if (samples[i].statmFd != -1) close(samples[i].statmFd);
+            if (samples[i].ioFd != -1) close(samples[i].ioFd);
+            if (samples[i].childrenFd != -1) close(samples[i].childrenFd);
+        }
+
+        sampleCount = kept;
+
+        if (frame >= 0) {
+            bufferWrite(&jobsOutput, STDOUT_FILENO);
+        }
+
+        // unmask the signals
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    }
+
+    sigprocmask(SIG_SETMASK, &previousMask, NULL);
+}
+
+// helper function that joins the tokens of a command back into a single line
+static char *joinTokens(const char **toks) {
+    size_t length = 0;
+
+    for (int i = 0; toks[i] != NULL; i++) {
+        length += strlen(toks[i]) + 1;
+    }
+
+    char *line = malloc(length + 1);
+    if (line == NULL) {
+        return NULL;
+    }
+
+    size_t lineIndex = 0;
+
+    for (int i = 0; toks[i] != NULL; i++) {
+        if (i > 0) {
+            line[lineIndex++] = ' ';
+        }
+        size_t tokenLength = strlen(toks[i]);
+        memcpy(line + lineIndex, toks[i], tokenLength);
+        lineIndex += tokenLength;
+    }
+
+    line[lineIndex] = '\0';
+    return line;
+}
+
+// helper function that checks if a command is one of crash's builtins
+static bool isBuiltin(const char *name) {
+    static const char *builtins[] = {"quit", "jobs", "nuke", "kill", "fg", "bg", "wait", "after", "coproc", "coproc-send",
+                                     "coproc-read", "coproc-close", "export", "unset", "cache", NULL};
+
+    for (int i = 0; builtins[i] != NULL; i++) {
+        if (strcmp(name, builtins[i]) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// helper function that finds the cache store, $CRASH_CACHE_DIR or ~/.cache/crash, creating it if needed
+static bool cacheDirectory(char *directory, size_t directoryLength) {
+    const char *configured = getVariable("CRASH_CACHE_DIR", strlen("CRASH_CACHE_DIR"));
+    const char *home = getVariable("HOME", strlen("HOME"));
+    int length;
+
+    if (configured != NULL && configured[0] != '\0') {
+        length = snprintf(directory, directoryLength, "%s", configured);
+    } else if (home != NULL && home[0] != '\0') {
+        length = snprintf(directory, directoryLength, "%s/.cache/crash", home);
+    } else {
+        return false;
+    }
+
+    if (length < 0 || (size_t) length >= directoryLength) {
+        return false;
+    }
+
+    // create any missing parents on the way
+    for (char *slash = strchr(directory + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(directory, 0700);
+        *slash = '/';
+    }
+    mkdir(directory, 0700);
+
+    struct stat directoryInfo;
+    return stat(directory, &directoryInfo) == 0 && S_ISDIR(directoryInfo.st_mode);
+}
+
+// helper function that returns how many bytes the cache store may use
+static unsigned long long cacheLimit() {
+    const char *configured = getVariable("CRASH_CACHE_SIZE", strlen("CRASH_CACHE_SIZE"));
+
+    if (configured != NULL) {
+        char *end;
+        unsigned long long limit = strtoull(configured, &end, 10);
+        if (end != configured && *end == '\0') {
+            return limit;
+        }
+    }
+
+    return CACHEDEFAULTSIZE;
+}
+
+// helper function that builds the key of a cached command: the directory it runs in, its tokens, the selected variables
+// and the identity of its input files (size, modification time and inode), returns false if an input is missing
+static bool cacheKey(struct outputBuffer *key, const char **command, const char **inputs, int inputCount, const char **names, int nameCount) {
+    char workingDirectory[PATH_MAX];
+    if (getcwd(workingDirectory, sizeof(workingDirectory)) == NULL) {
+        workingDirectory[0] = '\0';
+    }
+
+    // every field ends with a NUL so fields can't run into each other
+    bufferAppend(key, workingDirectory, strlen(workingDirectory) + 1);
+
+    for (int i = 0; command[i] != NULL; i++) {
+        bufferAppend(key, command[i], strlen(command[i]) + 1);
+    }
+
+    for (int i = 0; i < nameCount; i++) {
+        const char *value = getVariable(names[i], strlen(names[i]));
+
+        if (value != NULL) {
+            bufferPrintf(key, "\001env %s=%s", names[i], value);
+        } else {
+            bufferPrintf(key, "\001unset %s", names[i]);
+        }
+        bufferAppend(key, "", 1);
+    }
+
+    for (int i = 0; i < inputCount; i++) {
+        struct stat inputInfo;
+
+        if (stat(inputs[i], &inputInfo) == -1) {
+            char errorMessage[MAXLINE];
+            int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: cannot read cache input %s\n", inputs[i]);
+            write(STDERR_FILENO, errorMessage, errorMessageLength);
+            return false;
+        }
+
+        bufferPrintf(key, "\001input %s %lld %lld.%09ld %llu %llu", inputs[i], (long long) inputInfo.st_size,
+                     (long long) inputInfo.st_mtim.tv_sec, inputInfo.st_mtim.tv_nsec,
+                     (unsigned long long) inputInfo.st_ino, (unsigned long long) inputInfo.st_dev);
+        bufferAppend(key, "", 1);
+    }
+
+    return true;
+}
+
+// helper function that hashes a key into the name of its entry (64 bit FNV-1a), the full key is kept in the entry for collisions
+static uint64_t cacheHash(const char *data, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+// helper function that writes all of data, returns false if it couldn't
+static bool writeAll(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t result = write(fd, data, length);
+
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return false;
+        }
+
+        data += result;
+        length -= result;
+    }
+
+    return true;
+}
+
+// helper function that copies length bytes from one file to another, and also to a second file unless it's -1
+// returns false if the bytes couldn't all be read, or written to the second file
+static bool copyBytes(int from, int to, int alsoTo, uint64_t length) {
+    static char buffer[1 << 16];
+    bool copied = true;
+
+    while (length > 0) {
+        ssize_t result = read(from, buffer, length < sizeof(buffer) ? length : sizeof(buffer));
+
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return false;
+        }
+
+        writeAll(to, buffer, result);
+
+        if (alsoTo != -1 && !writeAll(alsoTo, buffer, result)) {
+            copied = false;
+            alsoTo = -1;
+        }
+
+        length -= result;
+    }
+
+    return copied;
+}
+
+// helper function that replays a stored entry if its key matches, without starting any process
+static bool cacheReplay(const char *entryPath, struct outputBuffer *key) {
+    int fd = open(entryPath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct cacheEntryHeader header;
+    bool valid = read(fd, &header, sizeof(header)) == sizeof(header) && header.magic == CACHEMAGIC &&
+                 header.version == CACHEVERSION && header.keyLength == key->length;
+
+    if (valid) {
+        char *storedKey = malloc(header.keyLength);
+        valid = storedKey != NULL && read(fd, storedKey, header.keyLength) == (ssize_t) header.keyLength &&
+                memcmp(storedKey, key->data, header.keyLength) == 0;
+        free(storedKey);
+    }
+
+    if (!valid) {
+        close(fd);
+        return false;
+    }
+
+    fflush(stdout);
+    copyBytes(fd, STDOUT_FILENO, -1, header.stdoutLength);
+    copyBytes(fd, STDERR_FILENO, -1, header.stderrLength);
+
+    // touching the entry moves it to the young end of the LRU order
+    futimens(fd, NULL);
+    close(fd);
+
+    lastExitStatus = header.exitStatus;
+    return true;
+}
+
+// helper function that lists the entries in the cache store, returns how many there are or -1
+static int cacheList(const char *directory, struct cacheFile **files) {
+    *files = NULL;
+
+    DIR *store = opendir(directory);
+    if (store == NULL) {
+        return -1;
+    }
+
+    int count = 0;
+    int capacity = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(store)) != NULL) {
+
+        // entries are named after the 16 hex digit hash of their key
+        if (strlen(entry->d_name) != 16 || strspn(entry->d_name, "0123456789abcdef") != 16) {
+            continue;
+        }
+
+        struct stat entryInfo;
+        if (fstatat(dirfd(store), entry->d_name, &entryInfo, AT_SYMLINK_NOFOLLOW) == -1 || !S_ISREG(entryInfo.st_mode)) {
+            continue;
+        }
+
+        if (count == capacity) {
+            int newCapacity = capacity == 0 ? 64 : capacity * 2;
+            struct cacheFile *newFiles = realloc(*files, newCapacity * sizeof(struct cacheFile));
+            if (newFiles == NULL) {
+                break;
+            }
+            *files = newFiles;
+            capacity = newCapacity;
+        }
+
+        memcpy((*files)[count].name, entry->d_name, 16);
+        (*files)[count].name[16] = '\0';
+        (*files)[count].size = entryInfo.st_size;
+        (*files)[count].modified = entryInfo.st_mtim;
+        count++;
     }
 
-    if (buf != NULL) free(buf);
-    if (ferror(stdin)) {
-        perror("ERROR");
-        return 1;
+    closedir(store);
+    return count;
+}
+
+// comparison function for qsort that puts the least recently used entries first
+static int compareCacheFiles(const void *a, const void *b) {
+    const struct cacheFile *first = a;
+    const struct cacheFile *second = b;
+
+    if (first->modified.tv_sec != second->modified.tv_sec) {
+        return first->modified.tv_sec < second->modified.tv_sec ? -1 : 1;
+    }
+    if (first->modified.tv_nsec != second->modified.tv_nsec) {
+        return first->modified.tv_nsec < second->modified.tv_nsec ? -1 : 1;
     }
     return 0;
 }
 
+// remove the least recently used entries until the store fits in its limit
+static void cacheEvict(const char *directory) {
+    struct cacheFile *files;
+    int count = cacheList(directory, &files);
 
-// function to handle sigint signals
-void sigintHandler(int signal) {
-    // function to handle sigint signals
-    if (foregroundPID != -1) {
-        kill(-foregroundPID, SIGINT);
+    unsigned long long total = 0;
+    for (int i = 0; i < count; i++) {
+        total += files[i].size;
     }
-}
 
+    unsigned long long limit = cacheLimit();
 
-// function to handle sigquit signals
-void sigquitHandler(int signal) {
-    if (foregroundPID != -1) {
-        kill(-foregroundPID, SIGQUIT);
-    } else {
-        // no foreground job: exit crash as per spec
-        exit(0);
+    if (total > limit) {
+        qsort(files, count, sizeof(struct cacheFile), compareCacheFiles);
+
+        for (int i = 0; i < count && total > limit; i++) {
+            char entryPath[PATH_MAX];
+            int entryPathLength = snprintf(entryPath, sizeof(entryPath), "%s/%s", directory, files[i].name);
+
+            if (entryPathLength > 0 && (size_t) entryPathLength < sizeof(entryPath) && unlink(entryPath) == 0) {
+                total -= files[i].size;
+                cacheStatistics.evictions++;
+            }
+        }
     }
+
+    free(files);
 }
 
-// function to handle sigtstp signals
-void sigtstpHandler(int signal) {
-    if (foregroundPID != -1) {
-        kill(-foregroundPID, SIGTSTP);
+// helper function that opens an anonymous file in the cache store to capture output in
+static int captureFile(const char *directory) {
+    int fd = open(directory, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+
+    // not every file system has O_TMPFILE
+    if (fd == -1) {
+        char capturePath[PATH_MAX];
+        int capturePathLength = snprintf(capturePath, sizeof(capturePath), "%s/.capture.XXXXXX", directory);
+
+        if (capturePathLength < 0 || (size_t) capturePathLength >= sizeof(capturePath)) {
+            return -1;
+        }
+
+        fd = mkostemp(capturePath, O_CLOEXEC);
+        if (fd != -1) {
+            unlink(capturePath);
+        }
     }
+
+    return fd;
 }
 
-// function to handle sigchild signals
+// helper function that shows the captured output of a command and stores it as a new entry
+static void cacheStore(const char *directory, const char *entryPath, struct outputBuffer *key, int stdoutFd, int stderrFd, int exitStatus, bool store) {
+    struct cacheEntryHeader header = {CACHEMAGIC, CACHEVERSION, exitStatus, key->length, 0, 0};
 
-void sigchildHandler(int signal) {
-    pid_t pid;
-    int status;
+    struct stat captureInfo;
+    if (fstat(stdoutFd, &captureInfo) == 0) {
+        header.stdoutLength = captureInfo.st_size;
+    }
+    if (fstat(stderrFd, &captureInfo) == 0) {
+        header.stderrLength = captureInfo.st_size;
+    }
 
-    while (true) {
+    // an entry bigger than the whole store isn't kept
+    unsigned long long entrySize = sizeof(header) + header.keyLength + header.stdoutLength + header.stderrLength;
+    if (entrySize > cacheLimit()) {
+        store = false;
+    }
 
-        // send a signal to the process
-        pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED);
-        if (pid <= 0) {
-            break;
-        }
+    // the entry is written under a temporary name and renamed into place, so a reader never sees half of it
+    char temporaryPath[PATH_MAX];
+    int entryFd = -1;
 
-        // find the job with the same pid
-        for (int i = 0; i < 32; i++) {
-            if (jobs[i].pid == pid) {
+    if (store) {
+        int temporaryPathLength = snprintf(temporaryPath, sizeof(temporaryPath), "%s/.entry.XXXXXX", directory);
 
-                int jobNumber = jobs[i].jobNumber;
-                char *commandName = jobs[i].commandName;
+        if (temporaryPathLength > 0 && (size_t) temporaryPathLength < sizeof(temporaryPath)) {
+            entryFd = mkostemp(temporaryPath, O_CLOEXEC);
+        }
+    }
 
-                if (WIFSTOPPED(status)) {
-                    jobs[i].stopped = true;
-                    jobs[i].running = false;
-                    
-                    signalMessage(jobNumber, pid, commandName, 2, -1);
-                } else if (WIFEXITED(status)) {
-                    jobs[i].running = false;
-                    jobs[i].stopped = false;
+    bool stored = entryFd != -1 && writeAll(entryFd, (const char *) &header, sizeof(header)) &&
+                  writeAll(entryFd, key->data, key->length);
 
-                    int exitStatus = WEXITSTATUS(status);
-                    signalMessage(jobNumber, pid, commandName, 0, exitStatus);
+    // the captured output goes to the terminal and into the entry in one pass
+    fflush(stdout);
+    lseek(stdoutFd, 0, SEEK_SET);
+    lseek(stderrFd, 0, SEEK_SET);
+    stored = copyBytes(stdoutFd, STDOUT_FILENO, stored ? entryFd : -1, header.stdoutLength) && stored;
+    stored = copyBytes(stderrFd, STDERR_FILENO, stored ? entryFd : -1, header.stderrLength) && stored;
 
-                } else if (WIFSIGNALED(status)) {
-                    jobs[i].running = false;
-                    jobs[i].stopped = false;
+    if (entryFd == -1) {
+        return;
+    }
 
-                    int signalNumber = WTERMSIG(status);
+    close(entryFd);
 
-                    if (signalNumber == SIGKILL || signalNumber == SIGINT) {
-                        signalMessage(jobNumber, pid, commandName, 1, -1);
-                    } else {
-                        signalMessage(jobNumber, pid, commandName, 1, signalNumber);
-                    }
-                } else if (WIFCONTINUED(status)) {
-                    jobs[i].stopped = false;
-                    jobs[i].running = true;
+    if (stored && rename(temporaryPath, entryPath) == 0) {
+        cacheStatistics.stores++;
+        cacheEvict(directory);
+    } else {
+        unlink(temporaryPath);
+    }
+}
 
-                    signalMessage(jobNumber, pid, commandName, 3, -1);
-                } else {
-                    jobs[i].running = false;
-                    jobs[i].stopped = false;
+// cache [--inputs FILE...] [--env NAME...] -- command...: runs a command with its output captured and stores it, keyed on
+// the command, the selected variables and the input files, and on later runs with the same key replays it without forking
+static void cacheCommand(const char **args) {
+    const char *inputs[MAXLINE];
+    int inputCount = 0;
+    const char *names[MAXLINE];
+    int nameCount = 0;
+    bool readingInputs = false;
+    bool readingNames = false;
 
-                    signalMessage(jobNumber, pid, commandName, 0, -1);
-                }
+    int i = 0;
+    for (; args[i] != NULL && strcmp(args[i], "--") != 0; i++) {
+        if (strcmp(args[i], "--inputs") == 0) {
+            readingInputs = true;
+            readingNames = false;
+            continue;
+        }
+        if (strcmp(args[i], "--env") == 0) {
+            readingInputs = false;
+            readingNames = true;
+            continue;
+        }
 
-                break;
-            }
+        size_t nameLength = variableNameLength(args[i]);
+
+        if (readingInputs && inputCount < MAXLINE) {
+            inputs[inputCount++] = args[i];
+        } else if (readingNames && nameCount < MAXLINE && nameLength > 0 && args[i][nameLength] == '\0') {
+            names[nameCount++] = args[i];
+        } else {
+            char errorMessage[MAXLINE];
+            int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: bad argument for cache: %s\n", args[i]);
+            write(STDERR_FILENO, errorMessage, errorMessageLength);
+            lastExitStatus = 1;
+            return;
         }
     }
-}
 
-// function to print the job finished text in a signal safe way
+    if (args[i] == NULL || args[i + 1] == NULL) {
+        const char *msg = "ERROR: cache needs a command after --\n";
+        write(STDERR_FILENO, msg, strlen(msg));
+        lastExitStatus = 1;
+        return;
+    }
 
-static void signalMessage(int jobNumber, pid_t pid, char *commandName, int exitStatus, int value) {
+    const char **command = args + i + 1;
 
-    char message[MAXLINE];
-    char pidString[10];
-    char jobNumberString[10];
+    // builtins don't write through a child's stdout, so there is nothing to capture
+    int name = 0;
+    while (command[name + 1] != NULL && isAssignment(command[name])) {
+        name++;
+    }
 
-    // convert numbers to strings
-    int pidLength = intToStringLength(pid, pidString, 10);
-    int jobNumberLength = intToStringLength(jobNumber, jobNumberString, 10);
-    
-    int messageIndex = 0;
+    if (isBuiltin(command[name])) {
+        char errorMessage[MAXLINE];
+        int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: cache can't run the builtin %s\n", command[name]);
+        write(STDERR_FILENO, errorMessage, errorMessageLength);
+        lastExitStatus = 1;
+        return;
+    }
 
-    // build the message
-    message[messageIndex++] = '[';
+    char directory[PATH_MAX];
+    if (!cacheDirectory(directory, sizeof(directory))) {
+        const char *msg = "ERROR: no cache directory, set CRASH_CACHE_DIR\n";
+        write(STDERR_FILENO, msg, strlen(msg));
+        lastExitStatus = 1;
+        return;
+    }
 
-    // add the job number
-    for (int i = 0; i < jobNumberLength; i++) {
-        message[messageIndex++] = jobNumberString[i];
+    struct outputBuffer key = {NULL, 0, 0};
+
+    if (!cacheKey(&key, command, inputs, inputCount, names, nameCount)) {
+        free(key.data);
+        lastExitStatus = 1;
+        return;
     }
 
-    message[messageIndex++] = ']';
-    message[messageIndex++] = ' ';
+    char entryPath[PATH_MAX];
+    int entryPathLength = snprintf(entryPath, sizeof(entryPath), "%s/%016llx", directory, (unsigned long long) cacheHash(key.data, key.length));
 
-    message[messageIndex++] = '(';
+    if (entryPathLength < 0 || (size_t) entryPathLength >= sizeof(entryPath)) {
+        const char *msg = "ERROR: cache directory path too long\n";
+        write(STDERR_FILENO, msg, strlen(msg));
+        free(key.data);
+        lastExitStatus = 1;
+        return;
+    }
 
-    // add the pid
-    for (int i = 0; i < pidLength; i++) {
-        message[messageIndex++] = pidString[i];
+    if (cacheReplay(entryPath, &key)) {
+        cacheStatistics.hits++;
+        free(key.data);
+        return;
     }
 
-    message[messageIndex++] = ')';
-    message[messageIndex++] = ' ';
-    message[messageIndex++] = ' ';
+    cacheStatistics.misses++;
 
-    // check what the status is
+    int stdoutFd = captureFile(directory);
+    int stderrFd = captureFile(directory);
 
-    // normal exit
-    if (exitStatus == 0) {
-        const char *finishedString = "finished";
-        for (int i = 0; finishedString[i] != '\0'; i++) {
-            message[messageIndex++] = finishedString[i];
-        }
+    if (stdoutFd == -1 || stderrFd == -1) {
+        char errorMessage[MAXLINE];
+        int errorMessageLength = snprintf(errorMessage, sizeof(errorMessage), "ERROR: cannot capture output in %s\n", directory);
+        write(STDERR_FILENO, errorMessage, errorMessageLength);
+        if (stdoutFd != -1) close(stdoutFd);
+        if (stderrFd != -1) close(stderrFd);
+        free(key.data);
+        lastExitStatus = 1;
+        return;
+    }
 
-        message[messageIndex++] = ' ';
-        message[messageIndex++] = ' ';
+    // run it as an ordinary foreground job with its output going to the capture files
+    int jobsStarted = processCount;
 
-        if (value > 0) {
+    captureFds[0] = stdoutFd;
+    captureFds[1] = stderrFd;
+    eval(command, false);
+    captureFds[0] = -1;
+    captureFds[1] = -1;
 
-            char valueString[10];
-            int valueLength = intToStringLength(value, valueString, sizeof(valueString));
-            for (int i = 0; i < valueLength; i++) {
-                message[messageIndex++] = valueString[i];
-            }
-        }
-    // signal termination
-    } else if (exitStatus == 1) {
-        const char *finishedString = "killed";
-        for (int i = 0; finishedString[i] != '\0'; i++) {
-            message[messageIndex++] = finishedString[i];
-        }
+    int exitStatus = lastExitStatus;
 
-        message[messageIndex++] = ' ';
-        message[messageIndex++] = ' ';
+    // a command that never started, couldn't be run (127) or was killed or suspended isn't stored
+    bool store = processCount != jobsStarted && exitStatus != 127 && exitStatus < 128;
+    cacheStore(directory, entryPath, &key, stdoutFd, stderrFd, exitStatus, store);
 
-        if (value > 0) {
-            char valueString[10];
-            int valueLength = intToStringLength(value, valueString, 10);
-            for (int i = 0; i < valueLength; i++) {
-                message[messageIndex++] = valueString[i];
-            }
-            message[messageIndex++] = ' ';
-            message[messageIndex++] = ' ';
-        }
-    } else if (exitStatus == 2) {
-        const char *finishedString = "suspended";
-        for (int i = 0; finishedString[i] != '\0'; i++) {
-            message[messageIndex++] = finishedString[i];
-        }
+    close(stdoutFd);
+    close(stderrFd);
+    free(key.data);
 
-        message[messageIndex++] = ' ';
-        message[messageIndex++] = ' ';
-    } else if (exitStatus == 3) {
-        const char *finishedString = "continued";
-        for (int i = 0; finishedString[i] != '\0'; i++) {
-            message[messageIndex++] = finishedString[i];
-        }
+    lastExitStatus = exitStatus;
+}
 
-        message[messageIndex++] = ' ';
-        message[messageIndex++] = ' ';
+// cache --stats: what the cache did in this session and how big the store is
+static void cacheStats() {
+    char directory[PATH_MAX];
+    if (!cacheDirectory(directory, sizeof(directory))) {
+        const char *msg = "ERROR: no cache directory, set CRASH_CACHE_DIR\n";
+        write(STDERR_FILENO, msg, strlen(msg));
+        lastExitStatus = 1;
+        return;
     }
 
-    // add the command name
-    for (int i = 0; i < strlen(commandName); i++) {
-        message[messageIndex++] = commandName[i];
+    struct cacheFile *files;
+    int count = cacheList(directory, &files);
+    unsigned long long total = 0;
+
+    for (int i = 0; i < count; i++) {
+        total += files[i].size;
     }
+    free(files);
+
+    long lookups = cacheStatistics.hits + cacheStatistics.misses;
+    char totalString[16];
+    char limitString[16];
+    formatBytes(total, totalString, sizeof(totalString));
+    formatBytes(cacheLimit(), limitString, sizeof(limitString));
+
+    printf("hits %ld  misses %ld  hit rate %.0f%%  stored %ld  evicted %ld\n", cacheStatistics.hits, cacheStatistics.misses,
+           lookups > 0 ? 100.0 * cacheStatistics.hits / lookups : 0.0, cacheStatistics.stores, cacheStatistics.evictions);
+    printf("%d entries  %s of %s  in %s\n", count > 0 ? count : 0, totalString, limitString, directory);
+    fflush(stdout);
+}
 
-    // add the newline
-    message[messageIndex++] = '\n';
+// cache --clear: remove every entry from the store
+static void cacheClear() {
+    char directory[PATH_MAX];
+    if (!cacheDirectory(directory, sizeof(directory))) {
+        const char *msg = "ERROR: no cache directory, set CRASH_CACHE_DIR\n";
+        write(STDERR_FILENO, msg, strlen(msg));
+        lastExitStatus = 1;
+        return;
+    }
 
-    // end the message
-    message[messageIndex] = '\0';
+    struct cacheFile *files;
+    int count = cacheList(directory, &files);
 
-    // write the message
-    write(STDOUT_FILENO, message, messageIndex);
+    for (int i = 0; i < count; i++) {
+        char entryPath[PATH_MAX];
+        int entryPathLength = snprintf(entryPath, sizeof(entryPath), "%s/%s", directory, files[i].name);
+
+        if (entryPathLength > 0 && (size_t) entryPathLength < sizeof(entryPath)) {
+            unlink(entryPath);
+        }
+    }
+
+    free(files);
 }
 
-// function to get the length of an integer in string form in a signal safe way
-static int intToStringLength(int number, char *buffer, int bufferLength) {
-    // use mod to repeatedly get the last digit
+// append raw bytes to an output buffer, growing it as needed
+static void bufferAppend(struct outputBuffer *buffer, const char *text, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        size_t newCapacity = buffer->capacity == 0 ? 4096 : buffer->capacity;
+        while (newCapacity < buffer->length + length) {
+            newCapacity *= 2;
+        }
 
-    int i = 0;
+        char *newData = realloc(buffer->data, newCapacity);
+        if (newData == NULL) {
+            return;
+        }
 
-    if (number == 0) {
-        buffer[0] = '0';
-        buffer[1] = '\0';
-        return 1;
+        buffer->data = newData;
+        buffer->capacity = newCapacity;
     }
 
-    while (number > 0) {
-        buffer[i] = number % 10 + '0';
-        number = number / 10;
-        i++;
+    memcpy(buffer->data + buffer->length, text, length);
+    buffer->length += length;
+}
+
+// append formatted text to an output buffer
+static void bufferPrintf(struct outputBuffer *buffer, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    va_list measureArgs;
+    va_copy(measureArgs, args);
+    int textLength = vsnprintf(NULL, 0, format, measureArgs);
+    va_end(measureArgs);
+
+    if (textLength < 0) {
+        va_end(args);
+        return;
     }
 
-    buffer[i] = '\0';
+    // grow the same way bufferAppend does, with room for the terminator vsnprintf writes
+    if (buffer->length + textLength + 1 > buffer->capacity) {
+        size_t newCapacity = buffer->capacity == 0 ? 4096 : buffer->capacity;
+        while (newCapacity < buffer->length + textLength + 1) {
+            newCapacity *= 2;
+        }
 
-    // reverse the string
-    int length = i;
+        char *newData = realloc(buffer->data, newCapacity);
+        if (newData == NULL) {
+            va_end(args);
+            return;
+        }
 
-    for (int j = 0; j < length / 2; j++) {
-        char temp = buffer[j];
-        buffer[j] = buffer[length - j - 1];
-        buffer[length - j - 1] = temp;
+        buffer->data = newData;
+        buffer->capacity = newCapacity;
     }
 
-    return length;
+    vsnprintf(buffer->data + buffer->length, textLength + 1, format, args);
+    va_end(args);
+    buffer->length += textLength;
 }
 
-// helper function that returns job index from the jobNumber
-static int findJobIndexByJobNumber(int jobNumber) {
-    for (int i = 0; i < 32; i++) {
-        if ((jobs[i].running || jobs[i].stopped) && jobs[i].jobNumber == jobNumber) {
-            return i;
+// append a string to an output buffer as a quoted and escaped JSON string
+static void bufferAppendJSONString(struct outputBuffer *buffer, const char *text) {
+    bufferAppend(buffer, "\"", 1);
+
+    if (text != NULL) {
+        for (int i = 0; text[i] != '\0'; i++) {
+            unsigned char c = text[i];
+
+            if (c == '"' || c == '\\') {
+                char escaped[2] = {'\\', c};
+                bufferAppend(buffer, escaped, 2);
+            } else if (c < 0x20) {
+                bufferPrintf(buffer, "\\u%04x", c);
+            } else {
+                bufferAppend(buffer, (const char *) &c, 1);
+            }
         }
     }
-    return -1;
+
+    bufferAppend(buffer, "\"", 1);
 }
 
+// write the whole contents of an output buffer, normally with a single write call
+static void bufferWrite(struct outputBuffer *buffer, int fd) {
+    size_t written = 0;
+
+    while (written < buffer->length) {
+        ssize_t result = write(fd, buffer->data + written, buffer->length - written);
+        if (result <= 0) {
+            break;
+        }
+        written += result;
+    }
+}
 
 
 int main(int argc, char **argv) {
 
     signal(SIGTTOU, SIG_IGN);
 
+    // writing to a coprocess that exited should be an error, not kill the shell
+    signal(SIGPIPE, SIG_IGN);
+
+    // publish the job table for external monitors
+    openJobSegment();
+
+    // the environment becomes exported shell variables
+    importEnvironment();
+
     // set up the sigchild handler
     struct sigaction sigHandlerMessage;
     sigHandlerMessage.sa_handler = sigchildHandler;
@@ -0,0 +1,48 @@
+#ifndef CRASH_SHM_H
+#define CRASH_SHM_H
+
+// layout of the shared-memory segment crash publishes its job table in
+// the segment is /dev/shm/crash.<shell pid> with mode 0600, crash is the only writer and any number of readers running as the
+// same user can map it read only
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define CRASH_SHM_MAGIC 0x68737263u // "crsh"
+#define CRASH_SHM_VERSION 1
+#define CRASH_SHM_COMMANDLEN 128
+
+// job states
+#define CRASH_SHM_EMPTY 0
+#define CRASH_SHM_RUNNING 1
+#define CRASH_SHM_SUSPENDED 2
+#define CRASH_SHM_PENDING 3
+#define CRASH_SHM_FINISHED 4
+
+struct crashShmJob {
+    int32_t jobNumber;
+    int32_t pid;
+    int32_t state;
+    int32_t exitStatus;
+    int64_t startTime;                   // seconds since the epoch
+    char command[CRASH_SHM_COMMANDLEN];  // command line, truncated and always NUL terminated
+};
+
+// the sequence number is a seqlock: it's odd while crash is updating the table, so a reader copies the
+// table and retries if the sequence was odd or changed while it was copying
+struct crashShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;
+    uint32_t jobCapacity;
+    int32_t shellPid;
+    uint32_t reserved;
+    struct crashShmJob jobs[];
+};
+
+// helper function that builds the segment name for a shell pid
+static inline void crashShmName(char *buffer, int bufferLength, int shellPid) {
+    snprintf(buffer, bufferLength, "/crash.%d", shellPid);
+}
+
+#endif
@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "crash_shm.h"
+
+// crashmon: prints the job table a running crash publishes in shared memory
+//
+// usage: crashmon PID [interval]
+//
+// with an interval it keeps printing the table every interval seconds. Reading the table never makes a
+// system call into crash, so any number of crashmon instances can watch the same shell.
+
+static const char *stateNames[] = {"empty", "running", "suspended", "pending", "finished"};
+
+
+// copy a consistent snapshot of the job table, retrying while crash is in the middle of an update
+static void readSnapshot(const struct crashShmHeader *segment, struct crashShmJob *snapshot, uint32_t jobCapacity) {
+    while (true) {
+        uint32_t before = __atomic_load_n(&segment->sequence, __ATOMIC_ACQUIRE);
+
+        if (before & 1) {
+            continue;
+        }
+
+        memcpy(snapshot, segment->jobs, jobCapacity * sizeof(struct crashShmJob));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        uint32_t after = __atomic_load_n(&segment->sequence, __ATOMIC_RELAXED);
+
+        if (before == after) {
+            return;
+        }
+    }
+}
+
+static void printSnapshot(const struct crashShmJob *snapshot, uint32_t jobCapacity) {
+    for (uint32_t i = 0; i < jobCapacity; i++) {
+        const struct crashShmJob *job = &snapshot[i];
+
+        if (job->state == CRASH_SHM_EMPTY || job->state > CRASH_SHM_FINISHED) {
+            continue;
+        }
+
+        char started[32];
+        time_t startTime = job->startTime;
+        strftime(started, sizeof(started), "%H:%M:%S", localtime(&startTime));
+
+        if (job->state == CRASH_SHM_FINISHED) {
+            printf("[%d] (%d)  %s %d  %s  started %s\n", job->jobNumber, job->pid, stateNames[job->state], job->exitStatus, job->command, started);
+        } else {
+            printf("[%d] (%d)  %s  %s  started %s\n", job->jobNumber, job->pid, stateNames[job->state], job->command, started);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s PID [interval]\n", argv[0]);
+        return 2;
+    }
+
+    double interval = 0;
+
+    if (argc == 3) {
+        char *end;
+        interval = strtod(argv[2], &end);
+
+        if (*end != '\0' || interval <= 0) {
+            fprintf(stderr, "ERROR: bad interval: %s\n", argv[2]);
+            return 2;
+        }
+    }
+
+    char name[64];
+    crashShmName(name, sizeof(name), atoi(argv[1]));
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1) {
+        fprintf(stderr, "ERROR: no job table for crash %s\n", argv[1]);
+        return 1;
+    }
+
+    struct stat segmentInfo;
+    if (fstat(fd, &segmentInfo) == -1 || segmentInfo.st_size < (off_t) sizeof(struct crashShmHeader)) {
+        fprintf(stderr, "ERROR: bad job table for crash %s\n", argv[1]);
+        close(fd);
+        return 1;
+    }
+
+    const struct crashShmHeader *segment = mmap(NULL, segmentInfo.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (segment == MAP_FAILED) {
+        perror("ERROR");
+        return 1;
+    }
+
+    uint32_t jobCapacity = segment->jobCapacity;
+    size_t expectedSize = sizeof(struct crashShmHeader) + jobCapacity * sizeof(struct crashShmJob);
+
+    if (__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != CRASH_SHM_MAGIC || segment->version != CRASH_SHM_VERSION ||
+        expectedSize > (size_t) segmentInfo.st_size) {
+        fprintf(stderr, "ERROR: unsupported job table for crash %s\n", argv[1]);
+        return 1;
+    }
+
+    struct crashShmJob *snapshot = malloc(jobCapacity * sizeof(struct crashShmJob));
+    if (snapshot == NULL) {
+        perror("ERROR");
+        return 1;
+    }
+
+    while (true) {
+        readSnapshot(segment, snapshot, jobCapacity);
+        printSnapshot(snapshot, jobCapacity);
+        fflush(stdout);
+
+        if (interval == 0) {
+            break;
+        }
+
+        printf("\n");
+
+        struct timespec delay;
+        delay.tv_sec = (time_t) interval;
+        delay.tv_nsec = (long) ((interval - (double) delay.tv_sec) * 1e9);
+        nanosleep(&delay, NULL);
+    }
+
+    free(snapshot);
+    return 0;
+}
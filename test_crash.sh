@@ -21,6 +21,13 @@ echo "[RUN] Scenario: two background jobs + nuke %1"
     # list jobs so we can see them as 'running'
     echo "jobs"
 
+    # machine readable listings
+    echo "jobs -l"
+    echo "jobs --json"
+
+    # one frame of the /proc resource monitor
+    echo "jobs --watch 0.1 1"
+
     # kill job %1
     echo "nuke %1"
 
@@ -30,11 +37,46 @@ echo "[RUN] Scenario: two background jobs + nuke %1"
     # list jobs again after nuke
     echo "jobs"
 
+    # talk to a long-lived helper over its stdin/stdout
+    echo "coproc echoer cat"
+    echo "coproc-send echoer ping from crash"
+    echo "coproc-read echoer"
+
     # exit the shell cleanly
     echo "quit"
 } | "$BIN" > test_out.txt 2> test_err.txt
 CRASH_STATUS=$?
 
+echo "[RUN] Scenario: kill by signal name, job name, command text and in bulk"
+{
+    echo "sleep 30 &"
+    echo "tail -n 1 -f /dev/null &"
+    echo "tail -f /dev/null &"
+    echo "tail -f /dev/null &"
+    sleep 0.5
+
+    # -SIG form, suspends job 1
+    echo "kill -STOP %1"
+    sleep 0.5
+
+    # -s SIG form picking a job by a piece of its command line
+    echo "kill -s KILL %?-n"
+    sleep 0.5
+
+    # %name picks both remaining tail jobs at once
+    echo "kill %tail"
+    sleep 0.5
+
+    # -s with no signal name is a usage error
+    echo "kill -s"
+
+    # the suspended sleep is woken up so SIGTERM can end it
+    echo "kill %sleep"
+    sleep 0.5
+
+    echo "quit"
+} | "$BIN" >> test_out.txt 2>> test_err.txt
+
 echo
 echo "==== crash stdout ===="
 cat test_out.txt
@@ -102,10 +144,46 @@ assert_contains "  running  sleep" test_out.txt \
 assert_count_at_least "  running  sleep" test_out.txt 2 \
     "two background sleep jobs reached the running state"
 
+# jobs -l shows the full command line
+assert_contains "  running  sleep 5" test_out.txt \
+    "jobs -l prints the full command line"
+
+# jobs --json prints a JSON array of jobs
+assert_contains '"state":"running","command":"sleep","commandLine":"sleep 5"' test_out.txt \
+    "jobs --json prints the job state and command"
+
+# jobs --watch samples the jobs from /proc
+assert_contains "JOB    PID      STATE   CPU%" test_out.txt \
+    "jobs --watch prints the resource monitor header"
+
 # nuke %1 should eventually produce a killed message
 assert_contains "  killed  sleep" test_out.txt \
     "nuke %1 produced a 'killed  sleep' message"
 
+# kill -STOP suspends the job
+assert_contains "  suspended  sleep" test_out.txt \
+    "kill -SIG sends the named signal"
+
+# kill -s KILL %?-n only hits the tail job with -n in its command line
+assert_contains "  killed  tail" test_out.txt \
+    "kill -s SIG %?text signals the job whose command line contains the text"
+
+# kill %tail terminates both remaining tail jobs
+assert_count_at_least "  killed  15  tail" test_out.txt 2 \
+    "kill %name signals every job whose command starts with the name"
+
+# kill %sleep wakes the suspended job up so SIGTERM ends it
+assert_contains "  killed  15  sleep" test_out.txt \
+    "kill terminates a suspended job"
+
+# kill -s without a signal name prints a usage error
+assert_contains "ERROR: kill -s needs a signal name" test_err.txt \
+    "kill -s without a signal name is rejected"
+
+# coproc-read prints the line the coprocess echoed back
+assert_contains "ping from crash" test_out.txt \
+    "coproc-send / coproc-read round trip through a coprocess"
+
 echo
 TOTAL=$((PASS + FAIL))
 if [ "$FAIL" -eq 0 ]; then
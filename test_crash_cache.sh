@@ -0,0 +1,165 @@
+#!/bin/sh
+# regression test script for crash: the cache builtin
+
+# -e: exit on first error
+# -u: treat unset variables as errors
+set -eu
+
+BIN=./crash
+OUT=test_cache_out.txt
+ERR=test_cache_err.txt
+DIR=test_cache_dir
+
+echo "[BUILD] Compiling crash..."
+
+# send the make output to /dev/null to reduce noise
+make crash >/dev/null
+
+# a command that counts how often it really runs
+rm -rf "$DIR"
+mkdir -p "$DIR"
+echo "first input" > "$DIR/input.txt"
+cat > "$DIR/command.sh" <<'EOF'
+#!/bin/sh
+echo run >> "$(dirname "$0")/runs.txt"
+echo cache-out
+echo cache-err >&2
+exit 3
+EOF
+chmod +x "$DIR/command.sh"
+
+echo "[RUN] Scenario: caching the output of a command"
+{
+    echo "export CRASH_CACHE_DIR=$DIR/store"
+
+    # the second run is replayed from the store
+    echo "cache --inputs $DIR/input.txt -- $DIR/command.sh"
+    echo "cache --inputs $DIR/input.txt -- $DIR/command.sh"
+    echo "echo replayed-status \$?"
+
+    # a changed input is a different key
+    echo "touch -d 2001-01-01 $DIR/input.txt"
+    echo "cache --inputs $DIR/input.txt -- $DIR/command.sh"
+
+    # a command that can't be run is never stored, so it fails the same way twice
+    echo "cache -- $DIR/missing-command"
+    echo "cache -- $DIR/missing-command"
+    echo "echo missing-status \$?"
+
+    echo "cache --stats"
+    echo "cache -- jobs"
+    echo "cache --clear"
+    echo "cache --stats"
+
+    # exit the shell cleanly
+    echo "quit"
+} | "$BIN" > "$OUT" 2> "$ERR"
+
+RUNS=$(wc -l < "$DIR/runs.txt")
+rm -rf "$DIR"
+
+echo
+echo "==== crash stdout ===="
+cat "$OUT"
+echo "======================"
+echo
+
+# show stderr if there was any
+if [ -s "$ERR" ]; then
+    echo "[WARN] stderr not empty:"
+    cat "$ERR"
+    echo
+fi
+
+PASS=0
+FAIL=0
+
+# assert that a file contains a fixed string at least once
+assert_contains() {
+    pattern="$1"
+    file="$2"
+    msg="$3"
+
+    if grep -F "$pattern" "$file" >/dev/null 2>&1; then
+        echo "PASS: $msg"
+        PASS=$((PASS+1))
+    else
+        echo "FAIL: $msg"
+        FAIL=$((FAIL+1))
+    fi
+}
+
+# assert that a file does not contain a fixed string
+assert_not_contains() {
+    pattern="$1"
+    file="$2"
+    msg="$3"
+
+    if grep -F "$pattern" "$file" >/dev/null 2>&1; then
+        echo "FAIL: $msg"
+        FAIL=$((FAIL+1))
+    else
+        echo "PASS: $msg"
+        PASS=$((PASS+1))
+    fi
+}
+
+# assert that a file contains a fixed string exactly count times
+assert_count() {
+    pattern="$1"
+    count="$2"
+    file="$3"
+    msg="$4"
+
+    if [ "$(grep -c -F "$pattern" "$file")" -eq "$count" ]; then
+        echo "PASS: $msg"
+        PASS=$((PASS+1))
+    else
+        echo "FAIL: $msg"
+        FAIL=$((FAIL+1))
+    fi
+}
+
+# CHECKS
+
+if [ "$RUNS" -eq 2 ]; then
+    echo "PASS: the command only runs again when its input changes"
+    PASS=$((PASS+1))
+else
+    echo "FAIL: the command only runs again when its input changes (ran $RUNS times)"
+    FAIL=$((FAIL+1))
+fi
+
+assert_count "cache-out" 3 "$OUT" \
+    "a hit replays stdout"
+
+assert_count "cache-err" 3 "$ERR" \
+    "a hit replays stderr"
+
+assert_contains "replayed-status 3" "$OUT" \
+    "a hit replays the exit status"
+
+assert_count "ERROR: cannot run" 2 "$ERR" \
+    "a command that can't be run isn't stored"
+
+assert_contains "missing-status 127" "$OUT" \
+    "a command that can't be run exits with 127"
+
+assert_contains "hits 1  misses 4" "$OUT" \
+    "cache --stats counts hits and misses"
+
+assert_contains "ERROR: cache can't run the builtin jobs" "$ERR" \
+    "cache refuses builtins"
+
+assert_contains "0 entries" "$OUT" \
+    "cache --clear empties the store"
+
+echo
+TOTAL=$((PASS + FAIL))
+if [ "$FAIL" -eq 0 ]; then
+    echo "RESULT (cache): ALL TESTS PASSED ($PASS/$TOTAL)"
+    exit 0
+else
+    echo "RESULT (cache): $FAIL TEST(S) FAILED, $PASS PASSED"
+    exit 1
+fi
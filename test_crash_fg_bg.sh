@@ -8,15 +8,16 @@ set -eu
 BIN=./crash
 OUT=test_fg_bg_out.txt
 ERR=test_fg_bg_err.txt
+MON=test_fg_bg_mon.txt
 FIFO=crash_in
 
 echo "[BUILD] Compiling crash..."
 
 # send the make output to /dev/null to reduce noise
-make crash >/dev/null
+make crash crashmon >/dev/null
 
 # remove any previous files or pipes
-rm -f "$OUT" "$ERR" "$FIFO"
+rm -f "$OUT" "$ERR" "$MON" "$FIFO"
 
 # make a named pipe (FIFO) so we can feed commands into crash
 mkfifo "$FIFO"
@@ -118,6 +119,9 @@ sleep 0.5
 send_cmd "bg $JOB2_PID"
 sleep 0.5
 
+# read the job table crash publishes in shared memory.
+./crashmon "$CRASH_PID" >"$MON" 2>&1 || true
+
 # kill the resumed background job with SIGKILL so it finishes during the test.
 kill -KILL "$JOB2_PID" 2>/dev/null || true
 sleep 0.5
@@ -190,6 +194,10 @@ assert_contains "($JOB2_PID)  continued  sleep" "$OUT" \
 assert_contains "($JOB2_PID)  killed  sleep" "$OUT" \
     "TEST 2: resumed background job eventually terminates with 'killed' status"
 
+# crashmon sees the resumed job in the shared-memory job table
+assert_contains "($JOB2_PID)  running  sleep 30" "$MON" \
+    "TEST 2: crashmon reports the resumed job as running"
+
 echo
 TOTAL=$((PASS + FAIL))
 if [ "$FAIL" -eq 0 ]; then
@@ -0,0 +1,106 @@
+#!/bin/sh
+# regression test script for crash: glob expansion of *, ? and [...] across directories
+
+# -e: exit on first error
+# -u: treat unset variables as errors
+set -eu
+
+BIN=./crash
+OUT=test_glob_out.txt
+ERR=test_glob_err.txt
+DIR=test_glob_dir
+
+echo "[BUILD] Compiling crash..."
+
+# send the make output to /dev/null to reduce noise
+make crash >/dev/null
+
+# build a small directory tree to glob over
+rm -rf "$DIR"
+mkdir -p "$DIR/a/sub" "$DIR/b/sub" "$DIR/c"
+touch "$DIR/a/x.log" "$DIR/a/y.log" "$DIR/a/.hidden.log" "$DIR/b/z.txt"
+touch "$DIR/a/sub/f" "$DIR/b/sub/f" "$DIR/c/q1" "$DIR/c/q2" "$DIR/c/qa"
+
+echo "[RUN] Scenario: glob patterns"
+{
+    echo "echo star: $DIR/a/*.log"
+    echo "echo nested: $DIR/*/sub/f"
+    echo "echo question: $DIR/c/q?"
+    echo "echo range: $DIR/c/q[0-9]"
+    echo "echo negated: $DIR/c/q[!0-9]"
+    echo "echo dotfile: $DIR/a/.*.log"
+    echo "echo nomatch: $DIR/*.none"
+    echo "echo dirs: $DIR/a/*/ $DIR/b/*.txt/"
+
+    # exit the shell cleanly
+    echo "quit"
+} | "$BIN" > "$OUT" 2> "$ERR"
+
+rm -rf "$DIR"
+
+echo
+echo "==== crash stdout ===="
+cat "$OUT"
+echo "======================"
+echo
+
+# show stderr if there was any
+if [ -s "$ERR" ]; then
+    echo "[WARN] stderr not empty:"
+    cat "$ERR"
+    echo
+fi
+
+PASS=0
+FAIL=0
+
+# assert that a file contains a fixed string at least once
+assert_contains() {
+    pattern="$1"
+    file="$2"
+    msg="$3"
+
+    if grep -F "$pattern" "$file" >/dev/null 2>&1; then
+        echo "PASS: $msg"
+        PASS=$((PASS+1))
+    else
+        echo "FAIL: $msg"
+        FAIL=$((FAIL+1))
+    fi
+}
+
+# CHECKS
+
+assert_contains "star: $DIR/a/x.log $DIR/a/y.log" "$OUT" \
+    "* matches every visible file, sorted"
+
+assert_contains "nested: $DIR/a/sub/f $DIR/b/sub/f" "$OUT" \
+    "patterns expand across directories"
+
+assert_contains "question: $DIR/c/q1 $DIR/c/q2 $DIR/c/qa" "$OUT" \
+    "? matches a single character"
+
+assert_contains "range: $DIR/c/q1 $DIR/c/q2" "$OUT" \
+    "[0-9] matches a range"
+
+assert_contains "negated: $DIR/c/qa" "$OUT" \
+    "[!0-9] matches outside a range"
+
+assert_contains "dotfile: $DIR/a/.hidden.log" "$OUT" \
+    "dot files are only matched by a leading dot"
+
+assert_contains "nomatch: $DIR/*.none" "$OUT" \
+    "a pattern without matches is passed through unchanged"
+
+assert_contains "dirs: $DIR/a/sub/ $DIR/b/*.txt/" "$OUT" \
+    "a trailing / only matches directories and keeps the slash"
+
+echo
+TOTAL=$((PASS + FAIL))
+if [ "$FAIL" -eq 0 ]; then
+    echo "RESULT (glob): ALL TESTS PASSED ($PASS/$TOTAL)"
+    exit 0
+else
+    echo "RESULT (glob): $FAIL TEST(S) FAILED, $PASS PASSED"
+    exit 1
+fi
@@ -0,0 +1,241 @@
+#!/bin/sh
+# regression test script for crash: exit statuses, $? and && / || command lists, loops, and jobs started with after
+
+# -e: exit on first error
+# -u: treat unset variables as errors
+set -eu
+
+BIN=./crash
+OUT=test_lists_out.txt
+ERR=test_lists_err.txt
+
+echo "[BUILD] Compiling crash..."
+
+# send the make output to /dev/null to reduce noise
+make crash >/dev/null
+
+echo "[RUN] Scenario: status tracking, short-circuit lists and dependent jobs"
+{
+    # jobs 3 and 4 wait on jobs 1 and 2, job 4 only if both succeed
+    echo "sleep 0.2 &"
+    echo "false &"
+    echo "after %1 -- echo after-ran"
+    echo "after -s %1 %2 -- echo after-should-not-run"
+    echo "after %1 %1 -- echo after-duplicate-ran"
+    echo "after %1 -- AFTER_VAR=after-env-ran printenv AFTER_VAR"
+    echo "wait"
+
+    # $? holds the status of the last command
+    echo "false; echo status-after-false \$?"
+    echo "true; echo status-after-true \$?"
+
+    # && only runs the next command on success, || only on failure
+    echo "false && echo and-should-not-run"
+    echo "true && echo and-ran"
+    echo "false || echo or-ran"
+    echo "true || echo or-should-not-run"
+    echo "false && echo skipped || echo fallback-ran"
+
+    # a whole list can run in the background and be waited on
+    echo "sleep 0.2 && echo background-list-ran &"
+    echo "wait"
+    echo "echo wait-status \$?"
+
+    # loops are parsed once and run their body for every word or count
+    echo "for x in one two; do echo loop-\$x; done"
+    echo "repeat 3 echo repeated"
+    echo "for x in a; do repeat 2 do echo nested-\$x; done; done"
+
+    # exit the shell cleanly
+    echo "quit"
+} | "$BIN" > "$OUT" 2> "$ERR"
+
+echo "[RUN] Scenario: nuke cancels a chain of dependent jobs"
+{
+    # cancelling job 2 must not start job 3, which waits on it
+    echo "sleep 100 &"
+    echo "after %1 -- echo chain-second-should-not-run"
+    echo "after %2 -- echo chain-third-should-not-run"
+    echo "nuke"
+    echo "sleep 0.2"
+
+    # exit the shell cleanly
+    echo "quit"
+} | "$BIN" >> "$OUT" 2>> "$ERR"
+
+echo "[RUN] Scenario: wait on listed jobs, any job, a PID, and ctrl+c"
+{
+    # job 2 fails first, job 1 finishes last, the status is the one of the last job listed
+    echo "sleep 0.3 &"
+    echo "false &"
+    echo "wait %1 %2"
+    echo "echo wait-last-operand \$?"
+
+    # wait -n returns as soon as one job is done, with its status
+    echo "sleep 5 &"
+    echo "false &"
+    echo "wait -n"
+    echo "echo wait-any \$?"
+
+    # a job killed by SIGTERM reports 128 + 15 when waited on by PID
+    echo "sleep 5.71 &"
+    echo "jobs -l"
+    sleep 0.5
+    PID=$(sed -n 's/.*(\([0-9]*\))  running  sleep 5\.71$/\1/p' "$OUT" | tail -n 1)
+    kill -TERM "$PID"
+    echo "wait $PID"
+    echo "echo wait-killed \$?"
+
+    # ctrl+c (SIGINT to crash, the parent of the job) interrupts wait with 128 + 2
+    echo "sleep 5.72 &"
+    echo "jobs -l"
+    sleep 0.5
+    PID=$(sed -n 's/.*(\([0-9]*\))  running  sleep 5\.72$/\1/p' "$OUT" | tail -n 1)
+    CRASH_PID=$(awk '/^PPid:/ { print $2 }' "/proc/$PID/status")
+    echo "wait"
+    sleep 0.5
+    kill -INT "$CRASH_PID"
+    echo "echo wait-interrupted \$?"
+
+    echo "nuke"
+
+    # exit the shell cleanly
+    echo "quit"
+} | "$BIN" >> "$OUT" 2>> "$ERR"
+
+echo
+echo "==== crash stdout ===="
+cat "$OUT"
+echo "======================"
+echo
+
+# show stderr if there was any
+if [ -s "$ERR" ]; then
+    echo "[WARN] stderr not empty:"
+    cat "$ERR"
+    echo
+fi
+
+PASS=0
+FAIL=0
+
+# assert that a file contains a fixed string at least once
+assert_contains() {
+    pattern="$1"
+    file="$2"
+    msg="$3"
+
+    if grep -F "$pattern" "$file" >/dev/null 2>&1; then
+        echo "PASS: $msg"
+        PASS=$((PASS+1))
+    else
+        echo "FAIL: $msg"
+        FAIL=$((FAIL+1))
+    fi
+}
+
+# assert that a file does not contain a fixed string
+assert_not_contains() {
+    pattern="$1"
+    file="$2"
+    msg="$3"
+
+    if grep -F "$pattern" "$file" >/dev/null 2>&1; then
+        echo "FAIL: $msg"
+        FAIL=$((FAIL+1))
+    else
+        echo "PASS: $msg"
+        PASS=$((PASS+1))
+    fi
+}
+
+# CHECKS
+
+assert_contains "after-ran" "$OUT" \
+    "after starts the command once its dependency finishes"
+
+assert_contains "[4] (-)  cancelled  echo" "$OUT" \
+    "after -s cancels the command when a dependency fails"
+
+assert_not_contains "after-should-not-run" "$OUT" \
+    "a cancelled after command never runs"
+
+assert_contains "after-duplicate-ran" "$OUT" \
+    "after waits on a job named twice only once"
+
+assert_contains "after-env-ran" "$OUT" \
+    "NAME=value words after the -- go into the environment of the dependent job"
+
+assert_not_contains "chain-third-should-not-run" "$OUT" \
+    "nuke doesn't start jobs that waited on a cancelled job"
+
+assert_contains "[3] (-)  cancelled  echo" "$OUT" \
+    "nuke cancels every pending job in a chain"
+
+assert_contains "status-after-false 1" "$OUT" \
+    "\$? is 1 after false"
+
+assert_contains "status-after-true 0" "$OUT" \
+    "\$? is 0 after true"
+
+assert_contains "and-ran" "$OUT" \
+    "&& runs the next command after success"
+
+assert_not_contains "and-should-not-run" "$OUT" \
+    "&& skips the next command after failure"
+
+assert_contains "or-ran" "$OUT" \
+    "|| runs the next command after failure"
+
+assert_not_contains "or-should-not-run" "$OUT" \
+    "|| skips the next command after success"
+
+assert_contains "fallback-ran" "$OUT" \
+    "a failed && chain falls through to ||"
+
+assert_contains "background-list-ran" "$OUT" \
+    "a list ending with & runs in the background"
+
+assert_contains "wait-status 0" "$OUT" \
+    "wait returns 0 once every job is done"
+
+assert_contains "wait-last-operand 1" "$OUT" \
+    "wait with several jobs returns the status of the last one listed"
+
+assert_contains "wait-any 1" "$OUT" \
+    "wait -n returns the status of the first job to finish"
+
+assert_contains "wait-killed 143" "$OUT" \
+    "wait PID returns 128 + signal for a killed job"
+
+assert_contains "wait-interrupted 130" "$OUT" \
+    "ctrl+c interrupts wait with status 130"
+
+assert_contains "loop-two" "$OUT" \
+    "for runs its body once per word"
+
+if [ "$(grep -c 'repeated' "$OUT")" -eq 3 ]; then
+    echo "PASS: repeat runs a command N times"
+    PASS=$((PASS+1))
+else
+    echo "FAIL: repeat runs a command N times"
+    FAIL=$((FAIL+1))
+fi
+
+if [ "$(grep -c 'nested-a' "$OUT")" -eq 2 ]; then
+    echo "PASS: loops nest"
+    PASS=$((PASS+1))
+else
+    echo "FAIL: loops nest"
+    FAIL=$((FAIL+1))
+fi
+
+echo
+TOTAL=$((PASS + FAIL))
+if [ "$FAIL" -eq 0 ]; then
+    echo "RESULT (lists): ALL TESTS PASSED ($PASS/$TOTAL)"
+    exit 0
+else
+    echo "RESULT (lists): $FAIL TEST(S) FAILED, $PASS PASSED"
+    exit 1
+fi
@@ -0,0 +1,132 @@
+#!/bin/sh
+# regression test script for crash: shell variables, export / unset and NAME=value prefixes
+
+# -e: exit on first error
+# -u: treat unset variables as errors
+set -eu
+
+BIN=./crash
+OUT=test_vars_out.txt
+ERR=test_vars_err.txt
+
+echo "[BUILD] Compiling crash..."
+
+# send the make output to /dev/null to reduce noise
+make crash >/dev/null
+
+echo "[RUN] Scenario: variables and the environment of programs"
+{
+    # a plain assignment is a shell variable, not in the environment
+    echo "GREETING=hello"
+    echo "echo var-\$GREETING \${GREETING}-braced"
+    echo "printenv GREETING || echo not-exported"
+
+    # export puts it in the environment, unset takes it out again
+    echo "export GREETING"
+    echo "printenv GREETING"
+    echo "export GREETING=bye-exported"
+    echo "printenv GREETING"
+    echo "unset GREETING"
+    echo "printenv GREETING || echo unset-gone"
+
+    # assignments in front of a command only go to that command
+    echo "ONLY=prefix-value printenv ONLY"
+    echo "echo after-prefix-\$ONLY."
+
+    # a word that is only an unset variable is dropped rather than passed as an empty argument
+    echo "\$NOTSET echo unset-word-dropped"
+
+    # the environment crash started with is imported
+    echo "echo home-\$HOME"
+
+    # entries without a valid name survive the environment being rebuilt by export
+    echo "printenv CRASH-TEST"
+
+    # exit the shell cleanly
+    echo "quit"
+} | env "CRASH-TEST=opaque-kept" "$BIN" > "$OUT" 2> "$ERR"
+
+echo
+echo "==== crash stdout ===="
+cat "$OUT"
+echo "======================"
+echo
+
+# show stderr if there was any
+if [ -s "$ERR" ]; then
+    echo "[WARN] stderr not empty:"
+    cat "$ERR"
+    echo
+fi
+
+PASS=0
+FAIL=0
+
+# assert that a file contains a fixed string at least once
+assert_contains() {
+    pattern="$1"
+    file="$2"
+    msg="$3"
+
+    if grep -F "$pattern" "$file" >/dev/null 2>&1; then
+        echo "PASS: $msg"
+        PASS=$((PASS+1))
+    else
+        echo "FAIL: $msg"
+        FAIL=$((FAIL+1))
+    fi
+}
+
+# assert that a file does not contain a fixed string
+assert_not_contains() {
+    pattern="$1"
+    file="$2"
+    msg="$3"
+
+    if grep -F "$pattern" "$file" >/dev/null 2>&1; then
+        echo "FAIL: $msg"
+        FAIL=$((FAIL+1))
+    else
+        echo "PASS: $msg"
+        PASS=$((PASS+1))
+    fi
+}
+
+# CHECKS
+
+assert_contains "var-hello hello-braced" "$OUT" \
+    "\$NAME and \${NAME} expand shell variables"
+
+assert_contains "not-exported" "$OUT" \
+    "a plain assignment isn't exported"
+
+assert_contains "bye-exported" "$OUT" \
+    "export NAME=value reaches programs"
+
+assert_contains "unset-gone" "$OUT" \
+    "unset removes a variable from the environment"
+
+assert_contains "prefix-value" "$OUT" \
+    "NAME=value in front of a command reaches that command"
+
+assert_contains "after-prefix-." "$OUT" \
+    "a prefix assignment doesn't set a shell variable"
+
+assert_contains "unset-word-dropped" "$OUT" \
+    "a word that expands to nothing is dropped"
+
+assert_contains "home-$HOME" "$OUT" \
+    "the starting environment is imported"
+
+assert_contains "opaque-kept" "$OUT" \
+    "environment entries that aren't valid names are kept after export"
+
+echo
+TOTAL=$((PASS + FAIL))
+if [ "$FAIL" -eq 0 ]; then
+    echo "RESULT (vars): ALL TESTS PASSED ($PASS/$TOTAL)"
+    exit 0
+else
+    echo "RESULT (vars): $FAIL TEST(S) FAILED, $PASS PASSED"
+    exit 1
+fi